@@ -4,6 +4,7 @@
 #include <mutex>
 using namespace std;
 
+template <class Hash = Murmur3Finalizer, class Index = FastRangeIndexing, class Layout = PaddedLayout, class Lock = mutex>
 class AlgorithmB {
 public:
     static constexpr int TOMBSTONE = -1;
@@ -12,20 +13,21 @@ public:
     char padding0[PADDING_BYTES];
     const int numThreads;
     int capacity;
+    Hash hasher;
+    hashStats * stats;                  // NULL unless built with STATS
     char padding2[PADDING_BYTES];
 
-    struct padded_bucket {
-        mutex m;
-        int key;
-        char padding[64 - (sizeof(int) + sizeof(mutex))];
-    };
-    
-    padded_bucket * data;
+    typename Layout::template storage<int, Lock> data;
 
     AlgorithmB(const int _numThreads, const int _capacity);
     ~AlgorithmB();
     bool insertIfAbsent(const int tid, const int & key);
     bool erase(const int tid, const int & key);
+    bool contains(const int tid, const int & key);
+    template <class Visit>
+    void forEach(const int tid, Visit visit);
+    template <class T, class Map, class Combine>
+    T reduce(const int tid, const T & identity, Map map, Combine combine);
     long getSumOfKeys();
     void printDebuggingDetails(); 
 };
@@ -36,78 +38,135 @@ public:
  * @param _numThreads maximum number of threads that will ever use the hash table (i.e., at least tid+1, where tid is the largest thread ID passed to any function of this class)
  * @param _capacity is the INITIAL size of the hash table (maximum number of elements it can contain WITHOUT expansion)
  */
-AlgorithmB::AlgorithmB(const int _numThreads, const int _capacity)
-: numThreads(_numThreads), capacity(_capacity) {
-    data = new padded_bucket[capacity];
+template <class Hash, class Index, class Layout, class Lock>
+AlgorithmB<Hash, Index, Layout, Lock>::AlgorithmB(const int _numThreads, const int _capacity)
+: numThreads(_numThreads), capacity(Index::roundCapacity(_capacity)), stats(NULL), data(capacity) {
     for (int i = 0; i < capacity; i++)
-        data[i].key = NULL_VALUE;
+        data.key(i) = NULL_VALUE;
+    STATS stats = new hashStats();
 }
 
 // destructor: clean up any allocated memory, etc.
-AlgorithmB::~AlgorithmB() {
-    delete[] data;
+template <class Hash, class Index, class Layout, class Lock>
+AlgorithmB<Hash, Index, Layout, Lock>::~AlgorithmB() {
+    // data frees its own buckets
+    delete stats;
 }
 
 // semantics: try to insert key. return true if successful (if key doesn't already exist), and false otherwise
-bool AlgorithmB::insertIfAbsent(const int tid, const int & key) {
-    u_int32_t h = murmur3(key);
-    for(int i = 0; i < capacity; i++) {
-        int index = (h + i) % capacity;
-        int found = data[index].key;
+template <class Hash, class Index, class Layout, class Lock>
+bool AlgorithmB<Hash, Index, Layout, Lock>::insertIfAbsent(const int tid, const int & key) {
+    int index = Index::home(hasher(key), capacity);
+    for(int i = 0; i < capacity; i++, index = Index::next(index, capacity)) {
+        int found = readUnlocked(data.lock(index), data.key(index));
         if (found == NULL_VALUE) {
-            data[index].m.lock();
-            found = data[index].key;
+            data.lock(index).lock();
+            found = data.key(index);
             if(found == NULL_VALUE) {
-                data[index].key = key;
-                data[index].m.unlock();
+                data.key(index) = key;
+                data.lock(index).unlock();
+                STATS stats->recordProbe(tid, i + 1);
                 return true;
             } else if(found == key) {
-                data[index].m.unlock();
+                data.lock(index).unlock();
+                STATS stats->recordProbe(tid, i + 1);
                 return false;
             }
-            data[index].m.unlock();
+            data.lock(index).unlock();
+            STATS stats->casFailures.inc(tid); // another thread filled the slot between our read and our lock
         } else if(found == key) {
+            STATS stats->recordProbe(tid, i + 1);
             return false;
         } 
     }
+    STATS stats->recordProbe(tid, capacity);
     return false;
 }
 
 // semantics: try to erase key. return true if successful, and false otherwise
-bool AlgorithmB::erase(const int tid, const int & key) {
-    u_int32_t h = murmur3(key);
-    for(int i = 0; i < capacity; i++) {
-        int index = (h + i) % capacity;
-        int found = data[index].key;
+template <class Hash, class Index, class Layout, class Lock>
+bool AlgorithmB<Hash, Index, Layout, Lock>::erase(const int tid, const int & key) {
+    int index = Index::home(hasher(key), capacity);
+    for(int i = 0; i < capacity; i++, index = Index::next(index, capacity)) {
+        int found = readUnlocked(data.lock(index), data.key(index));
         if(found == key) {
-            data[index].m.lock();
-            found = data[index].key;
+            data.lock(index).lock();
+            found = data.key(index);
             if(found == key) {
-                data[index].key = TOMBSTONE;
-                data[index].m.unlock();
+                data.key(index) = TOMBSTONE;
+                data.lock(index).unlock();
+                STATS stats->recordProbe(tid, i + 1);
                 return true;
             }
-            data[index].m.unlock();
+            data.lock(index).unlock();
+            STATS stats->casFailures.inc(tid); // another thread erased key between our read and our lock
+            STATS stats->recordProbe(tid, i + 1);
             return false;
         } else if(found == NULL_VALUE) {
+            STATS stats->recordProbe(tid, i + 1);
             return false;
         }
     }
+    STATS stats->recordProbe(tid, capacity);
     return false;
 }
 
-// semantics: return the sum of all KEYS in the set
-int64_t AlgorithmB::getSumOfKeys() {
-    int64_t sum = 0;
-    for(int i = 0; i < capacity; i++) {
-        int key = data[i].key;
-        if(key != NULL_VALUE && key != TOMBSTONE)
-            sum += key;
+// semantics: return true if key is in the set, and false otherwise
+template <class Hash, class Index, class Layout, class Lock>
+bool AlgorithmB<Hash, Index, Layout, Lock>::contains(const int tid, const int & key) {
+    int index = Index::home(hasher(key), capacity);
+    for(int i = 0; i < capacity; i++, index = Index::next(index, capacity)) {
+        int found = readUnlocked(data.lock(index), data.key(index));
+        if(found == key || found == NULL_VALUE) {
+            STATS stats->recordProbe(tid, i + 1);
+            return found == key;
+        }
     }
-    return sum;
+    STATS stats->recordProbe(tid, capacity);
+    return false;
+}
+
+/**
+ * semantics: call visit(key) for every key in the set, from several OpenMP threads at once. weakly consistent, and never blocks (or is blocked by) operations:
+ * a key that is in the set for the whole call is visited exactly once, and one that is inserted or erased meanwhile may or may not be
+ */
+template <class Hash, class Index, class Layout, class Lock>
+template <class Visit>
+void AlgorithmB<Hash, Index, Layout, Lock>::forEach(const int tid, Visit visit) {
+    parallelFor(capacity, [&](const int i) {
+        int key = readUnlocked(data.lock(i), data.key(i));
+        if(key != NULL_VALUE && key != TOMBSTONE)
+            visit(key);
+    });
+}
+
+// semantics: combine the results of map(key) for every key in the set, starting from identity and in no particular order (so combine must be associative and commutative). scans like forEach()
+template <class Hash, class Index, class Layout, class Lock>
+template <class T, class Map, class Combine>
+T AlgorithmB<Hash, Index, Layout, Lock>::reduce(const int tid, const T & identity, Map map, Combine combine) {
+    return parallelReduce(capacity, identity, [&](T & partial, const int i) {
+        int key = readUnlocked(data.lock(i), data.key(i));
+        if(key != NULL_VALUE && key != TOMBSTONE)
+            partial = combine(partial, map(key));
+    }, combine);
+}
+
+// semantics: return the sum of all KEYS in the set
+template <class Hash, class Index, class Layout, class Lock>
+int64_t AlgorithmB<Hash, Index, Layout, Lock>::getSumOfKeys() {
+    return reduce(0, (int64_t) 0, [](const int & key) { return (int64_t) key; }, [](const int64_t a, const int64_t b) { return a + b; });
 }
 
 // print any debugging details you want at the end of a trial in this function
-void AlgorithmB::printDebuggingDetails() {
-    
+template <class Hash, class Index, class Layout, class Lock>
+void AlgorithmB<Hash, Index, Layout, Lock>::printDebuggingDetails() {
+    STATS {
+        long long live = 0, tombstones = 0;
+        for(int i = 0; i < capacity; i++) {
+            if(data.key(i) == TOMBSTONE) tombstones++;
+            else if(data.key(i) != NULL_VALUE) live++;
+        }
+        hashStats::printSlotCounts("table", live, tombstones, capacity - live - tombstones);
+        stats->print(numThreads);
+    }
 }
\ No newline at end of file
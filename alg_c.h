@@ -3,29 +3,57 @@
 #include <atomic>
 using namespace std;
 
+/**
+ * Key is any type that fits a lock-free CAS: int (the default), 64-bit integers with single-word CAS, and fixedKey<16> (e.g., UUIDs) with a double-width CAS
+ * (cmpxchg16b, which gcc reaches through libatomic, hence -latomic). slots hold bare keys, so two values of Key mark empty and erased slots (see reservedKeys):
+ * those two keys are still valid, but are kept in reserved[] instead of a slot.
+ *
+ * erase leaves a TOMBSTONE that is never reused or cleared: an insert only claims an EMPTY slot, because claiming a tombstone before the rest of the probe
+ * is checked could let two concurrent inserts of a key succeed in different slots. so each erase uses up a slot for good, and a table under churn fills
+ * with tombstones until probes scan most of it and inserts fail. size it for every key that will ever be inserted (or use D, which rebuilds them away).
+ */
+template <class Hash = Murmur3Finalizer, class Index = FastRangeIndexing, class Layout = PaddedLayout, class Key = int>
 class AlgorithmC {
 public:
-    static constexpr int TOMBSTONE = -1;
-    static constexpr int NULL_VALUE = -2;
+    typedef Key key_t;
+    static constexpr Key TOMBSTONE = reservedKeys<Key>::tombstone();
+    static constexpr Key NULL_VALUE = reservedKeys<Key>::empty();
+    static constexpr int PREFETCH_DISTANCE = 16;   // batched operations prefetch the home slots of this many upcoming keys
+    static constexpr int BULK_RANGE_SIZE = 4096;   // a bulk load gives each OpenMP thread ranges of this many slots to fill
 
     char padding0[PADDING_BYTES];
     const int numThreads;
     int capacity;
+    Hash hasher;
+    hashStats * stats;                  // NULL unless built with STATS
+    atomic<bool> reserved[2];           // whether the keys NULL_VALUE and TOMBSTONE, which no slot can hold, are in the set
     char padding2[PADDING_BYTES];
 
-    struct padded_bucket {
-        atomic<int> key;
-        char padding[64 - (sizeof(atomic<int>))];
-    };
-
-    padded_bucket * data;
+    typename Layout::template storage<atomic<Key>, noLock> data;
 
     AlgorithmC(const int _numThreads, const int _capacity);
+    AlgorithmC(const int _numThreads, span<const Key> keys);
     ~AlgorithmC();
-    bool insertIfAbsent(const int tid, const int & key);
-    bool erase(const int tid, const int & key);
+    bool insertIfAbsent(const int tid, const Key & key);
+    bool erase(const int tid, const Key & key);
+    bool contains(const int tid, const Key & key);
+    void insertBatch(const int tid, const Key * keys, bool * results, const int n);
+    void eraseBatch(const int tid, const Key * keys, bool * results, const int n);
+    void containsBatch(const int tid, const Key * keys, bool * results, const int n);
+    template <class Visit>
+    void forEach(const int tid, Visit visit);
+    template <class T, class Map, class Combine>
+    T reduce(const int tid, const T & identity, Map map, Combine combine);
     long getSumOfKeys();
     void printDebuggingDetails(); 
+
+private:
+    bool insertHashed(const int tid, const Key & key, const uint32_t h);
+    bool eraseHashed(const int tid, const Key & key, const uint32_t h);
+    bool containsHashed(const int tid, const Key & key, const uint32_t h);
+    static int reservedIndex(const Key & key) { return (key == NULL_VALUE) ? 0 : (key == TOMBSTONE) ? 1 : -1; }
+    template <class Operation>
+    void pipelineBatch(const int tid, const Key * keys, bool * results, const int n, const bool forWrite, Operation operation);
 };
 
 /**
@@ -34,66 +62,257 @@ public:
  * @param _numThreads maximum number of threads that will ever use the hash table (i.e., at least tid+1, where tid is the largest thread ID passed to any function of this class)
  * @param _capacity is the INITIAL size of the hash table (maximum number of elements it can contain WITHOUT expansion)
  */
-AlgorithmC::AlgorithmC(const int _numThreads, const int _capacity)
-: numThreads(_numThreads), capacity(_capacity) {
-    data = new padded_bucket[capacity];
+template <class Hash, class Index, class Layout, class Key>
+AlgorithmC<Hash, Index, Layout, Key>::AlgorithmC(const int _numThreads, const int _capacity)
+: numThreads(_numThreads), capacity(Index::roundCapacity(_capacity)), stats(NULL), data(capacity) {
     for(int i = 0; i < capacity; i++)
-        data[i].key = NULL_VALUE;
+        data.key(i) = NULL_VALUE;
+    reserved[0] = reserved[1] = false;
+    STATS stats = new hashStats();
+}
+
+/**
+ * bulk-load constructor: a table holding keys (duplicates are inserted once), filled by all OpenMP threads instead of one insertIfAbsent() at a time.
+ * the table never grows, so it is sized for keys to fill half of it.
+ *
+ * the keys are grouped by the range of BULK_RANGE_SIZE slots their home slot falls in, and each range is filled by one thread with plain stores: linear probing from a home
+ * in the range only writes slots of that range until it runs off the end. the few keys that would (including those that wrap around the end of the table) are inserted
+ * afterwards with the usual CAS.
+ *
+ * @param _numThreads maximum number of threads that will ever use the hash table (i.e., at least tid+1, where tid is the largest thread ID passed to any function of this class)
+ * @param keys the initial contents of the set
+ */
+template <class Hash, class Index, class Layout, class Key>
+AlgorithmC<Hash, Index, Layout, Key>::AlgorithmC(const int _numThreads, span<const Key> keys)
+: numThreads(_numThreads), capacity(Index::roundCapacity(max((size_t) 1, 2 * keys.size()))), stats(NULL), data(capacity) {
+    STATS stats = new hashStats();
+    reserved[0] = reserved[1] = false;
+    #pragma omp parallel for schedule(static)
+    for(int i = 0; i < capacity; i++)
+        data.key(i).store(NULL_VALUE, memory_order_relaxed);
+
+    bulkPartition<Key> partition(keys, capacity, BULK_RANGE_SIZE, [&](const Key & key) { return Index::home(hashKey(hasher, key), capacity); });
+    vector<vector<Key>> spilled(omp_get_max_threads());
+    #pragma omp parallel for schedule(dynamic)
+    for(int r = 0; r < partition.numRanges(); r++) {
+        const int end = min((r + 1) * BULK_RANGE_SIZE, capacity);
+        for(size_t j = partition.start[r]; j < partition.start[r + 1]; j++) {
+            const Key key = partition.keys[j];
+            if(int which = reservedIndex(key); which >= 0) {
+                reserved[which] = true;
+                continue;
+            }
+            int index = partition.homes[j];
+            for(; index < end; index++) {
+                Key found = data.key(index).load(memory_order_relaxed);
+                if(found == key)
+                    break;
+                else if(found == NULL_VALUE) {
+                    data.key(index).store(key, memory_order_relaxed);
+                    break;
+                }
+            }
+            if(index == end)
+                spilled[omp_get_thread_num()].push_back(key);
+        }
+    }
+    // the end of the parallel region orders every store above before these inserts, and before the constructor returns
+    for(auto & keysOfThread : spilled)
+        for(const Key & key : keysOfThread)
+            insertIfAbsent(0, key);
 }
 
 // destructor: clean up any allocated memory, etc.
-AlgorithmC::~AlgorithmC() {
-    delete[] data;
+template <class Hash, class Index, class Layout, class Key>
+AlgorithmC<Hash, Index, Layout, Key>::~AlgorithmC() {
+    // data frees its own buckets
+    delete stats;
 }
 
 // semantics: try to insert key. return true if successful (if key doesn't already exist), and false otherwise
-bool AlgorithmC::insertIfAbsent(const int tid, const int & key) {
-    u_int32_t h = murmur3(key);
-    for(int i = 0; i < capacity; i++) {
-        int index = (h + i) % capacity;
-        int found = data[index].key;
+template <class Hash, class Index, class Layout, class Key>
+bool AlgorithmC<Hash, Index, Layout, Key>::insertIfAbsent(const int tid, const Key & key) {
+    return insertHashed(tid, key, hashKey(hasher, key));
+}
+
+// insertIfAbsent(), given h == hashKey(hasher, key)
+template <class Hash, class Index, class Layout, class Key>
+bool AlgorithmC<Hash, Index, Layout, Key>::insertHashed(const int tid, const Key & key, const uint32_t h) {
+    if(int which = reservedIndex(key); which >= 0)
+        return !reserved[which].exchange(true);
+    int index = Index::home(h, capacity);
+    for(int i = 0; i < capacity; i++, index = Index::next(index, capacity)) {
+        Key found = data.key(index);
         if(found == key) {
+            STATS stats->recordProbe(tid, i + 1);
             return false;
         } else if(found == NULL_VALUE) {
-            int expected = NULL_VALUE;
-            if(data[index].key.compare_exchange_strong(expected, key)) {
+            Key expected = NULL_VALUE;
+            if(data.key(index).compare_exchange_strong(expected, key)) {
+                STATS stats->recordProbe(tid, i + 1);
                 return true;
-            } if(data[index].key == key) {
+            }
+            STATS stats->casFailures.inc(tid);
+            if(data.key(index) == key) {
+                STATS stats->recordProbe(tid, i + 1);
                 return false;
             }
         }
     }
+    STATS stats->recordProbe(tid, capacity);
     return false;
 }
 
 // semantics: try to erase key. return true if successful, and false otherwise
-bool AlgorithmC::erase(const int tid, const int & key) {
-    u_int32_t h = murmur3(key);
-    for(int i = 0; i < capacity; i++) {
-        int index = (h + i) % capacity;
-        int found = data[index].key;
+template <class Hash, class Index, class Layout, class Key>
+bool AlgorithmC<Hash, Index, Layout, Key>::erase(const int tid, const Key & key) {
+    return eraseHashed(tid, key, hashKey(hasher, key));
+}
+
+// erase(), given h == hashKey(hasher, key)
+template <class Hash, class Index, class Layout, class Key>
+bool AlgorithmC<Hash, Index, Layout, Key>::eraseHashed(const int tid, const Key & key, const uint32_t h) {
+    if(int which = reservedIndex(key); which >= 0)
+        return reserved[which].exchange(false);
+    int index = Index::home(h, capacity);
+    for(int i = 0; i < capacity; i++, index = Index::next(index, capacity)) {
+        Key found = data.key(index);
         if(found == NULL_VALUE) {
+            STATS stats->recordProbe(tid, i + 1);
             return false;
         } else if(found == key) {
-            int expected = key;
-            return data[index].key.compare_exchange_strong(expected, TOMBSTONE);
+            STATS stats->recordProbe(tid, i + 1);
+            Key expected = key;
+            if(data.key(index).compare_exchange_strong(expected, TOMBSTONE))
+                return true;
+            STATS stats->casFailures.inc(tid);
+            return false;
         }
     }
+    STATS stats->recordProbe(tid, capacity);
     return false;
 }
 
-// semantics: return the sum of all KEYS in the set
-int64_t AlgorithmC::getSumOfKeys() {
-    int64_t sum = 0;
-    for(int i = 0; i < capacity; i++) {
-        int key = data[i].key;
-        if(key != NULL_VALUE && key != TOMBSTONE)
-            sum += key;
+// semantics: return true if key is in the set, and false otherwise (read-only: plain atomic loads, no CAS)
+template <class Hash, class Index, class Layout, class Key>
+bool AlgorithmC<Hash, Index, Layout, Key>::contains(const int tid, const Key & key) {
+    return containsHashed(tid, key, hashKey(hasher, key));
+}
+
+// contains(), given h == hashKey(hasher, key)
+template <class Hash, class Index, class Layout, class Key>
+bool AlgorithmC<Hash, Index, Layout, Key>::containsHashed(const int tid, const Key & key, const uint32_t h) {
+    if(int which = reservedIndex(key); which >= 0)
+        return reserved[which].load(memory_order_acquire);
+    int index = Index::home(h, capacity);
+    for(int i = 0; i < capacity; i++, index = Index::next(index, capacity)) {
+        Key found = data.key(index).load(memory_order_acquire);
+        if(found == key || found == NULL_VALUE) {
+            STATS stats->recordProbe(tid, i + 1);
+            return found == key;
+        }
     }
-    return sum;
+    STATS stats->recordProbe(tid, capacity);
+    return false;
+}
+
+/**
+ * runs operation(keys[j], hashKey(hasher, keys[j])) for j = 0..n-1 and stores the results in results[j].
+ * while operation j probes, the keys of operations j+1..j+PREFETCH_DISTANCE have already been hashed and their home slots prefetched,
+ * so a batch keeps up to PREFETCH_DISTANCE cache misses in flight instead of paying them one at a time.
+ */
+template <class Hash, class Index, class Layout, class Key>
+template <class Operation>
+void AlgorithmC<Hash, Index, Layout, Key>::pipelineBatch(const int tid, const Key * keys, bool * results, const int n, const bool forWrite, Operation operation) {
+    uint32_t hashes[PREFETCH_DISTANCE];
+    auto prefetch = [&](const int j) {
+        hashes[j % PREFETCH_DISTANCE] = hashKey(hasher, keys[j]);
+        auto * home = &data.key(Index::home(hashes[j % PREFETCH_DISTANCE], capacity));
+        if(forWrite)
+            __builtin_prefetch(home, 1);
+        else
+            __builtin_prefetch(home, 0);
+    };
+    for(int j = 0; j < min(n, (int) PREFETCH_DISTANCE); j++)
+        prefetch(j);
+    for(int j = 0; j < n; j++) {
+        const uint32_t h = hashes[j % PREFETCH_DISTANCE];
+        if(j + PREFETCH_DISTANCE < n)
+            prefetch(j + PREFETCH_DISTANCE);
+        results[j] = operation(keys[j], h);
+    }
+}
+
+// semantics: results[j] = insertIfAbsent(tid, keys[j]) for j = 0..n-1
+template <class Hash, class Index, class Layout, class Key>
+void AlgorithmC<Hash, Index, Layout, Key>::insertBatch(const int tid, const Key * keys, bool * results, const int n) {
+    pipelineBatch(tid, keys, results, n, true, [&](const Key & key, const uint32_t h) {
+        return insertHashed(tid, key, h);
+    });
+}
+
+// semantics: results[j] = erase(tid, keys[j]) for j = 0..n-1
+template <class Hash, class Index, class Layout, class Key>
+void AlgorithmC<Hash, Index, Layout, Key>::eraseBatch(const int tid, const Key * keys, bool * results, const int n) {
+    pipelineBatch(tid, keys, results, n, true, [&](const Key & key, const uint32_t h) {
+        return eraseHashed(tid, key, h);
+    });
+}
+
+// semantics: results[j] = contains(tid, keys[j]) for j = 0..n-1
+template <class Hash, class Index, class Layout, class Key>
+void AlgorithmC<Hash, Index, Layout, Key>::containsBatch(const int tid, const Key * keys, bool * results, const int n) {
+    pipelineBatch(tid, keys, results, n, false, [&](const Key & key, const uint32_t h) {
+        return containsHashed(tid, key, h);
+    });
+}
+
+/**
+ * semantics: call visit(key) for every key in the set, from several OpenMP threads at once. weakly consistent, and never blocks (or is blocked by) operations:
+ * a key that is in the set for the whole call is visited exactly once, and one that is inserted or erased meanwhile may or may not be
+ */
+template <class Hash, class Index, class Layout, class Key>
+template <class Visit>
+void AlgorithmC<Hash, Index, Layout, Key>::forEach(const int tid, Visit visit) {
+    parallelFor(capacity, [&](const int i) {
+        Key key = data.key(i).load(memory_order_acquire);
+        if(key != NULL_VALUE && key != TOMBSTONE)
+            visit(key);
+    });
+    if(reserved[0].load(memory_order_acquire)) visit(NULL_VALUE);
+    if(reserved[1].load(memory_order_acquire)) visit(TOMBSTONE);
+}
+
+// semantics: combine the results of map(key) for every key in the set, starting from identity and in no particular order (so combine must be associative and commutative). scans like forEach()
+template <class Hash, class Index, class Layout, class Key>
+template <class T, class Map, class Combine>
+T AlgorithmC<Hash, Index, Layout, Key>::reduce(const int tid, const T & identity, Map map, Combine combine) {
+    T result = parallelReduce(capacity, identity, [&](T & partial, const int i) {
+        Key key = data.key(i).load(memory_order_acquire);
+        if(key != NULL_VALUE && key != TOMBSTONE)
+            partial = combine(partial, map(key));
+    }, combine);
+    if(reserved[0].load(memory_order_acquire)) result = combine(result, map(NULL_VALUE));
+    if(reserved[1].load(memory_order_acquire)) result = combine(result, map(TOMBSTONE));
+    return result;
+}
+
+// semantics: return the sum of all KEYS in the set (of their keyChecksum(), for keys that aren't integers)
+template <class Hash, class Index, class Layout, class Key>
+int64_t AlgorithmC<Hash, Index, Layout, Key>::getSumOfKeys() {
+    return reduce(0, (int64_t) 0, [](const Key & key) { return keyChecksum(key); }, [](const int64_t a, const int64_t b) { return a + b; });
 }
 
 // print any debugging details you want at the end of a trial in this function
-void AlgorithmC::printDebuggingDetails() {
-    
+template <class Hash, class Index, class Layout, class Key>
+void AlgorithmC<Hash, Index, Layout, Key>::printDebuggingDetails() {
+    STATS {
+        long long live = 0, tombstones = 0;
+        for(int i = 0; i < capacity; i++) {
+            if(data.key(i) == TOMBSTONE) tombstones++;
+            else if(data.key(i) != NULL_VALUE) live++;
+        }
+        hashStats::printSlotCounts("table", live, tombstones, capacity - live - tombstones);
+        stats->print(numThreads);
+    }
 }
\ No newline at end of file
@@ -2,64 +2,167 @@
 #include "util.h"
 #include <atomic>
 #include <cmath>
+#include <new>
+#include <limits>
+#include <stdexcept>
+#include <cstdio>
+#include <fcntl.h>
+#include <sys/stat.h>
 using namespace std;
 
+/**
+ * slot layout of the default AlgorithmD: every slot is one 32-bit key.
+ * with these definitions, the largest "real" key we allow in the table is 0x7FFFFFFE, and the smallest is 1 !!
+ * (IndirectSlot in alg_d_wide.h and StringSlot in alg_d_string.h have no such limits: their words refer to the key instead of holding it)
+ *
+ * AlgorithmD keeps one instance of its slot layout (for those that need state, like StringSlot's key arena), and calls the functions below through it.
+ */
+struct KeySlot {
+    typedef int word_t;
+    typedef int key_t;
+    typedef int value_t;                                    // a set has no values; kept so that KeySlot and KeyValueSlot are interchangeable
+
+    static constexpr word_t MARKED_MASK = (int) 0x80000000; // most significant bit of a 32-bit key
+    static constexpr word_t TOMBSTONE = (int) 0x7FFFFFFF;   // largest value that doesn't use bit MARKED_MASK
+    static constexpr word_t EMPTY = (int) 0;
+    static constexpr bool OUT_OF_LINE = false;              // whether words refer to memory outside the slot array (so the array alone, e.g. a snapshot, isn't the set)
+    static constexpr bool RECLAIM_RECORDS = false;          // whether the memory of an erased or updated word must be released once no thread can still read it
+
+    // the word of (key, value), made by thread tid. h is hashKey() of key, for layouts that keep part of it in the word
+    static word_t make(const int tid, const key_t key, const value_t value, const uint32_t h) { return key; }
+    static key_t keyOf(const word_t word) { return word; }
+    static value_t valueOf(const word_t word) { return 0; }
+    // hashKey(hasher, keyOf(word)), which migration needs to place word in the new table
+    template <class Hash>
+    static uint32_t hashOf(const word_t word, const Hash & hasher) { return hashKey(hasher, keyOf(word)); }
+    // whether word, which may also be EMPTY, TOMBSTONE or MARKED, is the entry of key
+    static bool holds(const word_t word, const key_t & key, const uint32_t h) { return keyOf(word) == key; }
+    // whether word (like above) is the entry of the key of other, a word in the set
+    static bool sameKey(const word_t word, const word_t other) { return keyOf(word) == keyOf(other); }
+    // undoes make() of a word that thread tid never published
+    static void discard(const int tid, const word_t word) {}
+    // frees what make() allocated for a word that is no longer in any table (with RECLAIM_RECORDS)
+    static void release(const word_t word) {}
+};
+
+/**
+ * when AlgorithmD resizes, and to what size: a table expands once more than maxLoadFactor of its slots have been used (by keys or tombstones),
+ * and every expansion, rebuild or shrink allocates growthFactor slots per live key, so a new table starts 1 / growthFactor full (which must be below maxLoadFactor).
+ * tables never shrink below minCapacity (0: the capacity the set was constructed with).
+ * the defaults use 2 to 4 slots per key, for short probes. e.g. { 0.8, 1.5 } uses 1.25 to 1.5, at the cost of longer probes and more frequent migrations
+ */
+struct resizePolicy {
+    double maxLoadFactor = 0.5;
+    double growthFactor = 4;
+    int minCapacity = 0;
+};
+
+template <class Slot = KeySlot, class Hash = Murmur3Finalizer, class Index = FastRangeIndexing>
 class AlgorithmD {
+public:
+    typedef typename Slot::word_t word_t;
+    typedef typename Slot::key_t key_t;
+    typedef typename Slot::value_t value_t;
+
 private:
-    enum {
-        MARKED_MASK = (int) 0x80000000,     // most significant bit of a 32-bit key
-        TOMBSTONE = (int) 0x7FFFFFFF,       // largest value that doesn't use bit MARKED_MASK
-        EMPTY = (int) 0,
-        MAXIMUM_HASH = (uint32_t)0xFFFFFFFF
-    }; // with these definitions, the largest "real" key we allow in the table is 0x7FFFFFFE, and the smallest is 1 !!
+    static constexpr word_t MARKED_MASK = Slot::MARKED_MASK;
+    static constexpr word_t TOMBSTONE = Slot::TOMBSTONE;
+    static constexpr word_t EMPTY = Slot::EMPTY;
+    static constexpr word_t MOVED = TOMBSTONE | MARKED_MASK;   // an old slot whose key has been copied into the new table
+
+    static constexpr int CHUNK_SIZE = 4096;                     // slots migrated per claimed chunk, unless migrating incrementally
+    static constexpr int CATCH_UP_CHUNKS = 4;                   // resizing incrementally, the chunks an insert migrates when the new table reaches its threshold before the migration is done
+    static constexpr double MAX_TOMBSTONE_FRACTION = 0.25;     // rebuild a table once this fraction of its slots are tombstones
+    static constexpr double SHRINK_RATIO = 4;                   // shrink a table (down to minCapacity) once a rebuild would make it at least this many times smaller
+    static constexpr int PREFETCH_DISTANCE = 16;                // batched operations prefetch the home slots of this many upcoming keys
+    static constexpr size_t SNAPSHOT_HEADER_BYTES = 4096;       // the slot array of a snapshot file starts here, page aligned so that it can be mapped
+    static constexpr size_t RETIRE_BATCH = 256;                 // RECLAIM_RECORDS words a thread collects before retiring them to the reclaimer as one object (retire() takes a lock)
 
-    static constexpr int CHUNK_SIZE = 4096;
-    static constexpr int CAPCITY_INCREASE = 4;
+    // the start of a snapshot file (see saveSnapshot)
+    struct snapshotHeader {
+        char magic[8];
+        uint32_t wordBytes;             // sizeof(word_t), so a set's snapshot isn't loaded into a map or vice versa
+        uint32_t padding;
+        int64_t capacity;
+        int64_t live;
+        int64_t tombstones;
+        uint64_t layout;                // layoutFingerprint(capacity) of the table that was saved
+    };
+    static constexpr char SNAPSHOT_MAGIC[8] = "ALGDSNP";
+
+    // an array of capacity EMPTY slots, with its pages sized and placed on NUMA nodes according to memory. EMPTY is all zero bits, so the OS can hand out fresh zero pages
+    // instead of us writing every slot: the new table of an expansion then costs page faults spread over the operations (and nodes) that first touch each page,
+    // rather than one long memset in startExpansion() that would also first-touch the whole table onto one node
+    static atomic<word_t> * allocateSlots(const int capacity, const memoryPolicy & memory) {
+        static_assert(EMPTY == 0, "allocateSlots() relies on EMPTY being all zero bits");
+        atomic<word_t> * slots = (atomic<word_t> *) allocateZeroed((size_t) capacity * sizeof(atomic<word_t>), memory);
+        if(!slots)
+            throw bad_alloc();
+        return slots;
+    }
+
+    // the number of slots a table gets for numOfKeys live keys (but never more than an int can count)
+    static int capacityFor(const int64_t numOfKeys, const resizePolicy & resize) {
+        return (int) min(ceil((double) numOfKeys * resize.growthFactor), (double) numeric_limits<int>::max() / 2);
+    }
 
     struct table {
         char padding0[64];
-        atomic<int> * data;
-        atomic<int> * old;
+        atomic<word_t> * data;
+        atomic<word_t> * old;           // == prev->data while keys are being migrated out of prev
+        table * prev;                   // the table this one replaced. retired once every chunk of it has been migrated
         int capacity;
         int oldCapacity;
+        int chunkSize;                  // number of old slots per chunk
+        int oldChunks;                  // number of chunks of old to migrate (0 for the first table)
         int numThreads;
+        memoryPolicy memory;            // how data is allocated
+        bool fileMapped;                // data is a private mapping of a snapshot file (see loadSnapshot) rather than allocated according to memory
         counter * approxCounter;
         counter * deleteCounter;
         atomic<int> chuncksClaimed;
-        atomic<int> chuncksDone;
-        table(const int _capacity, const int _numThreads) 
-        : capacity(_capacity), numThreads(_numThreads), old(NULL), oldCapacity(0), chuncksClaimed(0), chuncksDone(0) {
-            data = new atomic<int>[capacity];
-            for(int i = 0; i < capacity; i++)
-                data[i].store(EMPTY, memory_order_relaxed);
+        atomic<int> chuncksDone;        // number of chunks of old that some thread has finished migrating
+        atomic<bool> * chunkDone;       // whether chunk c of old has been finished: a chunk claimed by a thread that stalls is finished by another (see finishMigration)
+        atomic<unsigned> chunksSwept;   // finishMigration() and catchUpMigration() visit chunk chunksSwept++ % oldChunks next
+        // with _data, the table takes over that array of _capacity slots (a file mapping) instead of allocating one
+        table(const int _capacity, const int _numThreads, const memoryPolicy & _memory, atomic<word_t> * _data = NULL)
+        : old(NULL), prev(NULL), capacity(Index::roundCapacity(_capacity)), oldCapacity(0), chunkSize(CHUNK_SIZE), oldChunks(0), numThreads(_numThreads), memory(_memory), fileMapped(_data != NULL), chuncksClaimed(0), chuncksDone(0), chunkDone(NULL), chunksSwept(0) {
+            data = fileMapped ? _data : allocateSlots(capacity, memory);
             approxCounter = new counter(_numThreads);
             deleteCounter = new counter(_numThreads);
         }
 
-        table(table * t) {
+        // sized for the keys that are still live in t, so a table full of tombstones is rebuilt at the same or a smaller size
+        table(table * t, const int minCapacity, const int _chunkSize, const resizePolicy & resize) {
+            prev = t;
             old = t->data;
             oldCapacity = t->capacity;
-            int insertCount = t->approxCounter->get();
-            int deleteCount = t->deleteCounter->get();
+            int insertCount = t->approxCounter->getAccurate();
+            int deleteCount = t->deleteCounter->getAccurate();
             int numOfKeys = insertCount - deleteCount; // number of keys in the table;
-            if (numOfKeys > 0)
-                capacity = numOfKeys * CAPCITY_INCREASE;
-            else
-                capacity = oldCapacity * CAPCITY_INCREASE;
-                
+            capacity = Index::roundCapacity(max(capacityFor(numOfKeys, resize), minCapacity));
+            // small (incremental) chunks must still finish the migration within the (maxLoadFactor - 1 / growthFactor) * capacity writes before the keys they insert
+            // could push this table to its expansion threshold (past which inserts have to catch up on the migration, see startExpansion).
+            // with the default policy, this is 2 old slots per write when doubling, and more when shrinking
+            const double headroom = (resize.maxLoadFactor - 1 / resize.growthFactor) * (double) capacity;
+            chunkSize = max(_chunkSize, (int) ceil((double) oldCapacity / headroom));
+            oldChunks = (oldCapacity + chunkSize - 1) / chunkSize;
+
             numThreads = t->numThreads;
+            memory = t->memory;
+            fileMapped = false;
             approxCounter = new counter(numThreads);
             deleteCounter = new counter(numThreads);
             chuncksClaimed.store(0, memory_order_relaxed);
             chuncksDone.store(0, memory_order_relaxed);
-            data = new atomic<int>[capacity];
-            for(int i = 0; i < capacity; i++)
-                data[i].store(EMPTY, memory_order_relaxed);
+            chunkDone = new atomic<bool>[oldChunks]();
+            chunksSwept.store(0, memory_order_relaxed);
+            data = allocateSlots(capacity, memory);
         }
 
         void print(int k) {
             for (int i = 0; i < k; i++) {
-                int temp = data[i];
+                word_t temp = data[i];
                 if (temp == TOMBSTONE)
                     cout << "O";
                 else if (temp == EMPTY)
@@ -70,211 +173,1062 @@ private:
             cout << "END\n *** \n *** \n";
         }
 
+        // old is owned by prev, so it is not freed here
         ~table() {
-            if(data)
-                delete[] data;
-            delete approxCounter, deleteCounter;
+            if(fileMapped)
+                munmap(data, (size_t) capacity * sizeof(atomic<word_t>));
+            else if(data)
+                freeZeroed(data, (size_t) capacity * sizeof(atomic<word_t>), memory);
+            delete approxCounter;
+            delete deleteCounter;
+            delete[] chunkDone;
         }
 
     };
-    
-    bool expandAsNeeded(const int tid, table * t, int i);
+
+    static void freeTable(void * t) {
+        delete (table *) t;
+    }
+
+    struct PaddedWords {
+        vector<word_t> words;
+        char padding[PADDING_BYTES];
+    };
+
+    // only for layouts with RECLAIM_RECORDS, whose release() needs no state
+    static void freeWords(void * words) {
+        for(const word_t & word : *(vector<word_t> *) words)
+            Slot::release(word);
+        delete (vector<word_t> *) words;
+    }
+
+    static bool migrating(table * t) {
+        return t->chuncksDone.load(memory_order_acquire) < t->oldChunks;
+    }
+    // word, read from an old array, holds a key that has been frozen for migration but not copied into the new table yet (see copyFrozen)
+    static bool beingCopied(const word_t & word) {
+        return (word & MARKED_MASK) && word != MOVED && word != (EMPTY | MARKED_MASK);
+    }
+
+    static void checkResizePolicy(const resizePolicy & resize) {
+        if(!(resize.maxLoadFactor > 0 && resize.maxLoadFactor < 1) || !(resize.growthFactor * resize.maxLoadFactor > 1) || resize.minCapacity < 0)
+            throw invalid_argument("resizePolicy needs 0 < maxLoadFactor < 1, growthFactor > 1 / maxLoadFactor and minCapacity >= 0");
+    }
+    void recordPublished(table * t);
+
+    bool overThreshold(table * t, int i);
+    bool compactAsNeeded(const int tid, table * t);
     void helpExpansion(const int tid, table * t);
-    void startExpansion(const int tid, table * t);
+    void migrateChunk(const int tid, table * t, int myChunk);
+    bool startExpansion(const int tid, table * t);
+    void finishMigration(const int tid, table * t);
+    void catchUpMigration(const int tid, table * t);
     void migrate(const int tid, table * t, int myChunk);
-    
+    void freezeAndCopy(const int tid, table * t, const int index);
+    void copyFrozen(const int tid, table * t, const int index, const word_t & frozen);
+    bool insertForMigration(const int tid, table * t, const word_t & word);
+    int findInOld(table * t, const key_t & key, const uint32_t h, const bool freezeEmpty, word_t & found);
+    void retireWord(const int tid, const word_t & word);
+    bool insertWord(const int tid, const word_t & word, const uint32_t h, bool disableExpansion);
+    bool insertKey(const int tid, const key_t & key, const value_t & value, const uint32_t h, bool disableExpansion);
+    bool updateWord(const int tid, const key_t & key, const word_t & desired, const uint32_t h);
+    bool eraseHashed(const int tid, const key_t & key, const uint32_t h);
+    bool containsHashed(const int tid, const key_t & key, const uint32_t h);
+    template <class Operation>
+    void pipelineBatch(const int tid, const key_t * keys, bool * results, const int n, const bool forWrite, Operation operation);
+    template <class Item, class KeyOf, class ToWord>
+    void bulkFill(table * t, span<const Item> items, KeyOf keyOf, ToWord toWord);
+    uint64_t layoutFingerprint(const int capacity);
+
     char padding0[PADDING_BYTES];
     int numThreads;
-    int initCapacity;
+    resizePolicy resize;
+    int minCapacity;                    // no table is smaller: resize.minCapacity, or else the capacity the set was constructed with
+    int migrationStep;                  // 0: an expansion is migrated in chunks of CHUNK_SIZE slots, by every insert, erase and update that encounters it, until none are left.
+                                        // otherwise: each insert and erase migrates at most one chunk of migrationStep slots. either way, lookups never migrate
+    Hash hasher;                        // shared by all tables, since migration rehashes keys into the new table
+    Slot slotLayout;                    // shared by all tables, like hasher. empty, except for layouts that keep state such as a key arena
+    hashStats * stats;                  // NULL unless built with STATS. shared by all tables, like hasher
     char padding1[PADDING_BYTES];
     atomic<table *> currentTable;
     char padding2[PADDING_BYTES];
-    
+    atomic<size_t> peakBytes;           // see peakTableBytes()
+    epochReclaimer reclaimer;           // frees replaced tables once no thread can still be probing them. every operation (and every restart of one, which reloads currentTable) begins with reclaimer.enter(tid)
+    PaddedWords * retiredOfThread;      // RECLAIM_RECORDS words that thread tid erased or overwrote, not yet handed to reclaimer (see retireWord)
+
 public:
-    AlgorithmD(const int _numThreads, const int _capacity);
+    AlgorithmD(const int _numThreads, const int _capacity, const int _migrationStep = 0, const memoryPolicy & _memory = memoryPolicy(), const resizePolicy & _resize = resizePolicy());
+    AlgorithmD(const int _numThreads, span<const key_t> keys, const int _migrationStep = 0, const memoryPolicy & _memory = memoryPolicy(), const resizePolicy & _resize = resizePolicy());
     ~AlgorithmD();
-    bool insertIfAbsent(const int tid, const int & key, bool disableExpansion);
-    bool erase(const int tid, const int & key);
-    bool insertForMigration(const int tid, const int & key);
+    bool insertIfAbsent(const int tid, const key_t & key, bool disableExpansion = false);
+    bool insertIfAbsent(const int tid, const key_t & key, const value_t & value, bool disableExpansion = false);
+    bool update(const int tid, const key_t & key, const value_t & value);
+    bool get(const int tid, const key_t & key, value_t & value);
+    bool erase(const int tid, const key_t & key);
+    bool contains(const int tid, const key_t & key);
+    void insertBatch(const int tid, const key_t * keys, bool * results, const int n);
+    void eraseBatch(const int tid, const key_t * keys, bool * results, const int n);
+    void containsBatch(const int tid, const key_t * keys, bool * results, const int n);
+    template <class Visit>
+    void forEach(const int tid, Visit visit);
+    template <class T, class Map, class Combine>
+    T reduce(const int tid, const T & identity, Map map, Combine combine);
+    bool saveSnapshot(const int tid, const char * path);
+    bool loadSnapshot(const char * path);
     long getSumOfKeys();
-    void printDebuggingDetails(); 
+    size_t tableBytes();
+    size_t peakTableBytes();
+    void printDebuggingDetails();
 };
 
 /**
  * constructor: initialize the hash table's internals
- * 
+ *
  * @param _numThreads maximum number of threads that will ever use the hash table (i.e., at least tid+1, where tid is the largest thread ID passed to any function of this class)
  * @param _capacity is the INITIAL size of the hash table (maximum number of elements it can contain WITHOUT expansion)
+ * @param _migrationStep if positive, resize incrementally: each insert and erase migrates at most this many old slots, so no single operation pays for a whole expansion.
+ *                       the old and new tables coexist (lookups check both) until the migration is complete
+ * @param _memory how the slots of every table are allocated: their page size and how they are spread over NUMA nodes (see memoryPolicy in util.h)
+ * @param _resize when the table expands, and how large each new table is (see resizePolicy). throws invalid_argument if it can't work
+ */
+template <class Slot, class Hash, class Index>
+AlgorithmD<Slot, Hash, Index>::AlgorithmD(const int _numThreads, const int _capacity, const int _migrationStep, const memoryPolicy & _memory, const resizePolicy & _resize)
+: numThreads(_numThreads), resize(_resize), minCapacity(Index::roundCapacity(_resize.minCapacity > 0 ? _resize.minCapacity : _capacity)), migrationStep(max(_migrationStep, 0)),
+  stats(NULL), peakBytes(0), reclaimer(_numThreads) {
+    checkResizePolicy(resize);
+    retiredOfThread = new PaddedWords[_numThreads];
+    currentTable = new table(max(_capacity, minCapacity), _numThreads, _memory);
+    recordPublished(currentTable);
+    STATS stats = new hashStats();
+}
+
+/**
+ * bulk-load constructor: a table holding keys (duplicates are inserted once, with value_t() in a map), filled by all OpenMP threads instead of one insertIfAbsent() at a time
+ * (see bulkFill). the table is sized like a rebuild that migrates keys.size() keys: resize.growthFactor slots per key (but at least one chunk),
+ * and unless resize.minCapacity is set, that is also the capacity it never shrinks below. other parameters are as in the constructor above
  */
-AlgorithmD::AlgorithmD(const int _numThreads, const int _capacity)
-: numThreads(_numThreads), initCapacity(_capacity) {
-    currentTable = new table(_capacity, _numThreads); 
+template <class Slot, class Hash, class Index>
+AlgorithmD<Slot, Hash, Index>::AlgorithmD(const int _numThreads, span<const key_t> keys, const int _migrationStep, const memoryPolicy & _memory, const resizePolicy & _resize)
+: numThreads(_numThreads), resize(_resize), migrationStep(max(_migrationStep, 0)), stats(NULL), peakBytes(0), reclaimer(_numThreads) {
+    checkResizePolicy(resize);
+    const int capacity = Index::roundCapacity(max(CHUNK_SIZE, capacityFor(keys.size(), resize)));
+    minCapacity = (resize.minCapacity > 0) ? Index::roundCapacity(resize.minCapacity) : capacity;
+    retiredOfThread = new PaddedWords[_numThreads];
+    table * t = new table(max(capacity, minCapacity), _numThreads, _memory);
+    currentTable = t;
+    recordPublished(t);
+    STATS stats = new hashStats();
+    bulkFill(t, keys, [](const key_t & key) { return key; }, [&](const key_t & key, const uint32_t h) { return slotLayout.make(omp_get_thread_num(), key, value_t(), h); });
+}
+
+/**
+ * fills the empty table t, which no other thread can reach yet, with the words toWord(items[j], hashKey(hasher, keyOf(items[j]))) (the first of any with the same key),
+ * using all OpenMP threads. toWord is only called for the items that are inserted.
+ * the words are grouped by the chunk of CHUNK_SIZE slots their home slot falls in, and each chunk is filled by one thread with plain stores: linear probing from a home
+ * in the chunk only writes slots of that chunk until it runs off the end. the few words that would (including those that wrap around the end of the table) are inserted
+ * afterwards with the CAS that migration uses.
+ */
+template <class Slot, class Hash, class Index>
+template <class Item, class KeyOf, class ToWord>
+void AlgorithmD<Slot, Hash, Index>::bulkFill(table * t, span<const Item> items, KeyOf keyOf, ToWord toWord) {
+    bulkPartition<Item> partition(items, t->capacity, CHUNK_SIZE, [&](const Item & item) { return Index::home(hashKey(hasher, keyOf(item)), t->capacity); });
+    vector<vector<word_t>> spilled(omp_get_max_threads());
+    int64_t placed = 0;
+    #pragma omp parallel for schedule(dynamic) reduction(+:placed)
+    for(int r = 0; r < partition.numRanges(); r++) {
+        const int end = min((r + 1) * CHUNK_SIZE, t->capacity);
+        for(size_t j = partition.start[r]; j < partition.start[r + 1]; j++) {
+            const key_t key = keyOf(partition.keys[j]);
+            const uint32_t h = hashKey(hasher, key);
+            int index = partition.homes[j];
+            for(; index < end; index++) {
+                word_t found = t->data[index].load(memory_order_relaxed);
+                if(slotLayout.holds(found, key, h))
+                    break;
+                else if(found == EMPTY) {
+                    t->data[index].store(toWord(partition.keys[j], h), memory_order_relaxed);
+                    placed++;
+                    break;
+                }
+            }
+            if(index == end)
+                spilled[omp_get_thread_num()].push_back(toWord(partition.keys[j], h));
+        }
+    }
+    t->approxCounter->add(placed);
+    // the end of the parallel region orders every store above before these inserts, and before t is published
+    for(auto & wordsOfThread : spilled)
+        for(const word_t & word : wordsOfThread)
+            if(!insertForMigration(0, t, word))
+                slotLayout.discard(0, word); // a duplicate
 }
 
 // destructor: clean up any allocated memory, etc.
-AlgorithmD::~AlgorithmD() {
+template <class Slot, class Hash, class Index>
+AlgorithmD<Slot, Hash, Index>::~AlgorithmD() {
+    // tables that were already retired are freed by the reclaimer's destructor
     table * t = currentTable;
+    if constexpr (Slot::RECLAIM_RECORDS) {
+        // the records of the keys in the set (which may still be in t->old), and of the words retired since each thread's last batch
+        auto releaseAll = [&](atomic<word_t> * slots, const int capacity) {
+            for(int i = 0; i < capacity; i++) {
+                word_t word = slots[i].load(memory_order_relaxed) & ~MARKED_MASK; // MOVED becomes TOMBSTONE
+                if(word != EMPTY && word != TOMBSTONE)
+                    slotLayout.release(word);
+            }
+        };
+        if(t) {
+            releaseAll(t->data, t->capacity);
+            if(migrating(t))
+                releaseAll(t->old, t->oldCapacity);
+        }
+        for(int tid = 0; tid < numThreads; tid++)
+            for(const word_t & word : retiredOfThread[tid].words)
+                slotLayout.release(word);
+    }
+    delete[] retiredOfThread;
     if(t) {
-        if(t->old)
-            delete[] currentTable.load()->old;
-        if(t->approxCounter)
-            delete currentTable.load()->approxCounter;
-        if(t->deleteCounter)
-            delete currentTable.load()->deleteCounter;
+        if(t->prev)
+            delete t->prev;
         delete t;
     }
+    delete stats;
 }
 
-bool AlgorithmD::expandAsNeeded(const int tid, table * t, int i) {
-    helpExpansion(tid, t);
-    if(((t->approxCounter->get()) > (0.5 * t->capacity)) ||
-        ((i > 100) && ((t->approxCounter->getAccurate()) > t->capacity/2))) {
-            startExpansion(tid, t);
-            return true;
+// whether t has reached its expansion threshold, for an insert at step i of its probe
+template <class Slot, class Hash, class Index>
+bool AlgorithmD<Slot, Hash, Index>::overThreshold(table * t, int i) {
+    const double threshold = resize.maxLoadFactor * (double) t->capacity;
+    return ((double) t->approxCounter->get() > threshold) ||
+        ((i > 100) && ((double) t->approxCounter->getAccurate() > threshold));
+}
+
+// erase() never reuses slots: sustained churn fills a table with tombstones that lengthen every probe, and mass deletion leaves a large table mostly empty.
+// either way, rebuild t with the same chunked migration that expansion uses.
+template <class Slot, class Hash, class Index>
+bool AlgorithmD<Slot, Hash, Index>::compactAsNeeded(const int tid, table * t) {
+    if(migrating(t))
+        return false; // unlike an expansion, a rebuild can wait until t has received all of its keys
+    int64_t deleted = t->deleteCounter->get();
+    int64_t live = t->approxCounter->get() - deleted;
+    if((deleted <= MAX_TOMBSTONE_FRACTION * t->capacity) &&
+        ((t->capacity <= minCapacity) || ((double) live * resize.growthFactor * SHRINK_RATIO >= (double) t->capacity)))
+            return false;
+    // get() omits unflushed per-thread increments, so confirm with the accurate counts before paying for a rebuild
+    deleted = t->deleteCounter->getAccurate();
+    live = t->approxCounter->getAccurate() - deleted;
+    if((deleted > MAX_TOMBSTONE_FRACTION * t->capacity) ||
+        ((t->capacity > minCapacity) && ((double) live * resize.growthFactor * SHRINK_RATIO < (double) t->capacity))) {
+            return startExpansion(tid, t);
     }
     return false;
 }
 
-void AlgorithmD::helpExpansion(const int tid, table * t) {
-    int totalOldChunks = ceil(t->oldCapacity / (double) CHUNK_SIZE);
-    while(t->chuncksClaimed < totalOldChunks) {
+/**
+ * claims and migrates chunks of t->old until every chunk has been claimed (or, when resizing incrementally, at most one chunk).
+ * this never waits for chunks that other threads claimed: until they are done, operations look up the keys they haven't copied yet in t->old.
+ */
+template <class Slot, class Hash, class Index>
+void AlgorithmD<Slot, Hash, Index>::helpExpansion(const int tid, table * t) {
+    while(t->chuncksClaimed.load(memory_order_relaxed) < t->oldChunks) {
         int myChunk = t->chuncksClaimed.fetch_add(1);
-        if(myChunk < totalOldChunks) {
-            migrate(tid, t, myChunk);
-            t->chuncksDone.fetch_add(1);
-        }
+        if(myChunk < t->oldChunks)
+            migrateChunk(tid, t, myChunk);
+        if(migrationStep)
+            break;
     }
-    while(t->chuncksDone < totalOldChunks);
 }
 
-void AlgorithmD::startExpansion(const int tid, table * t) {
+// migrates chunk myChunk of t->old, and counts it as done unless another thread finished it first
+template <class Slot, class Hash, class Index>
+void AlgorithmD<Slot, Hash, Index>::migrateChunk(const int tid, table * t, int myChunk) {
+    migrate(tid, t, myChunk);
+    STATS stats->chunksMigrated.inc(tid);
+    if(t->chunkDone[myChunk].exchange(true))
+        return;
+    if(t->chuncksDone.fetch_add(1) == t->oldChunks - 1) {
+        // we migrated the last chunk, so t->prev is only reachable by threads that loaded it before it was replaced
+        reclaimer.retire(tid, t->prev, freeTable);
+        t->prev = NULL;
+    }
+}
+
+// replace t with a new table (unless another thread already has) and help migrate into it. returns true if t is no longer the current table,
+// and false if t is still migrating and we are resizing incrementally: then the caller goes on with t, above its threshold
+template <class Slot, class Hash, class Index>
+bool AlgorithmD<Slot, Hash, Index>::startExpansion(const int tid, table * t) {
+    // t reached its load threshold before all of t->old was copied into it, so a thread that claimed a chunk must have stalled.
+    // t can't be frozen while some of its keys are still in t->old, so we finish that chunk ourselves first. when resizing incrementally,
+    // a single operation mustn't pay for that, so it only migrates a few more chunks, and t keeps taking inserts until the migration is done
+    if(migrating(t)) {
+        if(migrationStep)
+            catchUpMigration(tid, t);
+        else
+            finishMigration(tid, t);
+        if(migrating(t))
+            return false;
+    }
     if(currentTable == t) {
-        table * t_new = new table(t);
-        if(!currentTable.compare_exchange_strong(t, t_new))
-            delete t_new;
-        else {
-            if(t->old)
-                delete[] t->old;
+        table * t_new = new table(t, minCapacity, migrationStep ? migrationStep : CHUNK_SIZE, resize);
+        if(!currentTable.compare_exchange_strong(t, t_new)) {
+            delete t_new; // never published, so nobody else can reach it
+        } else {
+            recordPublished(t_new);
+            STATS stats->expansions.inc(tid);
         }
     }
     helpExpansion(tid, currentTable);
+    return true;
 }
 
-void AlgorithmD::migrate(const int tid, table * t, int myChunk) {
-    int start_index = myChunk * CHUNK_SIZE;
-    int end_index = min((myChunk + 1) * CHUNK_SIZE, t->oldCapacity);
-    for(int i = start_index; i < end_index; i++) {
-        int key = t->old[i];
-        if(key == TOMBSTONE)
-            continue;
-        else {
-            while(!t->old[i].compare_exchange_strong(key, key | MARKED_MASK)) {
-                key = t->old[i];
-            }
-            if((key != TOMBSTONE) && (key != EMPTY)) {
-                insertForMigration(tid, key);
+// completes the migration of t: migrates every chunk that hasn't been claimed yet, even when resizing incrementally, and then every chunk that no thread has finished,
+// including those that other threads claimed (we finish the copies they have started, see freezeAndCopy), so we never wait for them. on return, migrating(t) is false
+template <class Slot, class Hash, class Index>
+void AlgorithmD<Slot, Hash, Index>::finishMigration(const int tid, table * t) {
+    while(t->chuncksClaimed.load(memory_order_relaxed) < t->oldChunks) {
+        int myChunk = t->chuncksClaimed.fetch_add(1);
+        if(myChunk < t->oldChunks)
+            migrateChunk(tid, t, myChunk);
+    }
+    while(migrating(t)) {
+        const int chunk = t->chunksSwept.fetch_add(1, memory_order_relaxed) % (unsigned) t->oldChunks;
+        if(!t->chunkDone[chunk].load(memory_order_acquire))
+            migrateChunk(tid, t, chunk);
+    }
+}
+
+/**
+ * resizing incrementally, t reached its load threshold before its migration was done: migrates up to CATCH_UP_CHUNKS chunks of t->old that no thread has finished
+ * (claimed or not), and visits at most every chunk once, so the operation that calls this stays bounded. the migration is sized to be done well before t fills up
+ * (see the table constructor), so only a few stalled chunks are ever left, and the inserts after the threshold finish them long before t runs out of EMPTY slots
+ */
+template <class Slot, class Hash, class Index>
+void AlgorithmD<Slot, Hash, Index>::catchUpMigration(const int tid, table * t) {
+    int migrated = 0;
+    for(int visited = 0; visited < t->oldChunks && migrated < CATCH_UP_CHUNKS && migrating(t); visited++) {
+        const int chunk = t->chunksSwept.fetch_add(1, memory_order_relaxed) % (unsigned) t->oldChunks;
+        if(!t->chunkDone[chunk].load(memory_order_acquire)) {
+            migrateChunk(tid, t, chunk);
+            migrated++;
+        }
+    }
+}
+
+// copies the keys of one chunk of t->old into t (see freezeAndCopy)
+template <class Slot, class Hash, class Index>
+void AlgorithmD<Slot, Hash, Index>::migrate(const int tid, table * t, int myChunk) {
+    int start_index = myChunk * t->chunkSize;
+    int end_index = min((myChunk + 1) * t->chunkSize, t->oldCapacity);
+    for(int i = start_index; i < end_index; i++)
+        freezeAndCopy(tid, t, i);
+}
+
+/**
+ * freezes t->old[index] by setting its MARKED bit, so threads still operating on the old table retry on t, and copies its key into t.
+ * a frozen key is still the authoritative copy until the slot becomes MOVED, after its copy has been inserted into t.
+ * EMPTY slots may already have been frozen by an insert (see findInOld), and TOMBSTONEs never change, so neither needs marking.
+ * if another thread froze the slot first, we finish its copy as well, so when we return the slot is EMPTY, TOMBSTONE or MOVED
+ */
+template <class Slot, class Hash, class Index>
+void AlgorithmD<Slot, Hash, Index>::freezeAndCopy(const int tid, table * t, const int index) {
+    word_t word = t->old[index].load(memory_order_acquire);
+    while((word != TOMBSTONE) && !(word & MARKED_MASK)) {
+        if(t->old[index].compare_exchange_strong(word, word | MARKED_MASK)) {
+            word |= MARKED_MASK;
+            break;
+        }
+    }
+    copyFrozen(tid, t, index, word);
+}
+
+/**
+ * t->old[index] held frozen, a key frozen for migration. copies it into t (unless another thread already has) and replaces the old slot with MOVED.
+ * any number of threads may do this at once, so no thread ever waits for one that froze a key to finish copying it, and the key is still copied only once:
+ * after probing t, and before placing the key in an EMPTY slot, we check that the old slot hasn't become MOVED. the key can't be erased from t before then
+ * (erase() copies it first, like this), and slots are never EMPTY again, so if the check passes, a copy another thread has made is either one we met on our probe,
+ * or one in a slot we found taken (our CAS fails there) or that was EMPTY when we passed it (their CAS failed there).
+ * returns right away if frozen isn't a key that is being copied
+ */
+template <class Slot, class Hash, class Index>
+void AlgorithmD<Slot, Hash, Index>::copyFrozen(const int tid, table * t, const int index, const word_t & frozen) {
+    if(!beingCopied(frozen))
+        return;
+    const word_t word = frozen & ~MARKED_MASK;
+    const uint32_t h = slotLayout.hashOf(word, hasher);
+    int slot = Index::home(h, t->capacity);
+    for(int i = 0; i < t->capacity; i++, slot = Index::next(slot, t->capacity)) {
+        word_t found = t->data[slot].load(memory_order_acquire);
+        if(found == EMPTY) {
+            if(t->old[index].load(memory_order_acquire) != frozen)
+                return; // another thread has made the copy
+            if(t->data[slot].compare_exchange_strong(found, word)) {
+                t->approxCounter->inc(tid);
+                break;
             }
-                
         }
+        if(found & MARKED_MASK)
+            return; // t itself is being migrated, which only starts once every old slot is MOVED
+        else if(slotLayout.sameKey(found, word))
+            break;
     }
+    word_t expected = frozen;
+    t->old[index].compare_exchange_strong(expected, MOVED, memory_order_release);
 }
 
-bool AlgorithmD::insertForMigration(const int tid, const int & key) {
-    table * t = currentTable;
-    double ii = murmur3(key);
-    uint32_t h = floor(ii / MAXIMUM_HASH * (uint32_t)t->capacity);
-    for(int i = 0; i < t->capacity; i++) {
-        int index = (h + i) % t->capacity;
-        int found = t->data[index].load(memory_order_relaxed);
-        if(found == key)
+// copies a whole slot word (key and, for maps, its value) from the old array into t
+template <class Slot, class Hash, class Index>
+bool AlgorithmD<Slot, Hash, Index>::insertForMigration(const int tid, table * t, const word_t & word) {
+    // only the word moves: with a layout that keeps the hash in the word (StringSlot), the key itself isn't read unless another word has the same hash
+    const uint32_t h = slotLayout.hashOf(word, hasher);
+    int index = Index::home(h, t->capacity);
+    for(int i = 0; i < t->capacity; i++, index = Index::next(index, t->capacity)) {
+        word_t found = t->data[index].load(memory_order_acquire);
+        if(slotLayout.sameKey(found, word))
             return false;
         else if(found == EMPTY) {
-            int expected = EMPTY;
-            if(t->data[index].compare_exchange_strong(expected, key)) {
+            word_t expected = EMPTY;
+            if(t->data[index].compare_exchange_strong(expected, word)) {
                 t->approxCounter->inc(tid);
                 return true;
             }
             found = t->data[index];
-            if(found == key)
+            if(slotLayout.sameKey(found, word))
                 return false;
         }
     }
-        
+
     return false;
 }
 
-// semantics: try to insert key. return true if successful (if key doesn't already exist), and false otherwise
-bool AlgorithmD::insertIfAbsent(const int tid, const int & key, bool disableExpansion = false) {
+/**
+ * looks key up in t->old while t is migrating. returns the index of the slot holding key, which may be frozen (MARKED) but not yet MOVED, and stores its word in found.
+ * returns -1 if key is not in t->old. with freezeEmpty, the EMPTY slot that ends the probe is frozen first,
+ * so a thread that is still inserting into the old table can't add key there after we have decided to insert it into t.
+ */
+template <class Slot, class Hash, class Index>
+int AlgorithmD<Slot, Hash, Index>::findInOld(table * t, const key_t & key, const uint32_t h, const bool freezeEmpty, word_t & found) {
+    int index = Index::home(h, t->oldCapacity);
+    for(int i = 0; i < t->oldCapacity; i++, index = Index::next(index, t->oldCapacity)) {
+        found = t->old[index].load(memory_order_acquire);
+        if(found == EMPTY) {
+            if(!freezeEmpty || t->old[index].compare_exchange_strong(found, EMPTY | MARKED_MASK))
+                return -1;
+            // the slot was filled (or frozen) first: examine its new contents
+        }
+        if((found & ~MARKED_MASK) == EMPTY)
+            return -1;
+        else if(slotLayout.holds(found & ~MARKED_MASK, key, h))
+            return index;
+    }
+    return -1;
+}
+
+// word was just replaced in a table by erase() or update(). with RECLAIM_RECORDS, its record may still be read by operations that loaded word before,
+// so it is freed by the reclaimer (in batches of RETIRE_BATCH words, which also keeps retire() and its lock off the path of most operations)
+template <class Slot, class Hash, class Index>
+void AlgorithmD<Slot, Hash, Index>::retireWord(const int tid, const word_t & word) {
+    if constexpr (Slot::RECLAIM_RECORDS) {
+        vector<word_t> & batch = retiredOfThread[tid].words;
+        batch.push_back(word);
+        if(batch.size() >= RETIRE_BATCH) {
+            reclaimer.retire(tid, new vector<word_t>(move(batch)), freeWords);
+            batch.clear();
+        }
+    }
+}
+
+template <class Slot, class Hash, class Index>
+bool AlgorithmD<Slot, Hash, Index>::insertWord(const int tid, const word_t & word, const uint32_t h, bool disableExpansion) {
+    reclaimer.enter(tid);
     table * t = currentTable;
-    double ii = murmur3(key);
-    uint32_t h = floor(ii / MAXIMUM_HASH * (uint32_t)t->capacity);
-    for(int i = 0; i < t->capacity; i++) {
-        if(!disableExpansion && expandAsNeeded(tid, t, i))
-            return insertIfAbsent(tid, key);
-        int index = (h + i) % t->capacity;
-        int found = t->data[index];
-        if(found & MARKED_MASK)
-            return insertIfAbsent(tid, key);
-        else if(found == key)
+    const key_t key = slotLayout.keyOf(word);
+    if(migrating(t)) {
+        helpExpansion(tid, t);
+        word_t found;
+        if(migrating(t) && findInOld(t, key, h, true, found) >= 0)
+            return false; // key hasn't been copied into t yet, but it is in the set
+    }
+    int index = Index::home(h, t->capacity);
+    for(int i = 0; i < t->capacity; i++, index = Index::next(index, t->capacity)) {
+        if(!disableExpansion && overThreshold(t, i)) {
+            if(startExpansion(tid, t))
+                return insertWord(tid, word, h, false);
+            disableExpansion = true; // t is still migrating (see startExpansion), so we insert into it above its threshold, without catching up again at every step
+        }
+        word_t found = t->data[index];
+        if(found & MARKED_MASK) {
+            STATS stats->markedRetries.inc(tid);
+            return insertWord(tid, word, h, false);
+        } else if(slotLayout.holds(found, key, h)) {
+            STATS stats->recordProbe(tid, i + 1);
             return false;
-        else if(found == EMPTY) {
-            int expected = EMPTY;
-            if(t->data[index].compare_exchange_strong(expected, key)) {
+        } else if(found == EMPTY) {
+            word_t expected = EMPTY;
+            if(t->data[index].compare_exchange_strong(expected, word)) {
                 t->approxCounter->inc(tid);
+                STATS stats->recordProbe(tid, i + 1);
                 return true;
             }
-            int found = t->data[index];
-            if(found & MARKED_MASK)
-                return insertIfAbsent(tid, key);
-            else if(found == key)
+            STATS stats->casFailures.inc(tid);
+            word_t found = t->data[index];
+            if(found & MARKED_MASK) {
+                STATS stats->markedRetries.inc(tid);
+                return insertWord(tid, word, h, false);
+            } else if(slotLayout.holds(found, key, h)) {
+                STATS stats->recordProbe(tid, i + 1);
                 return false;
+            }
         }
-        
+
     }
+    STATS stats->recordProbe(tid, t->capacity);
+    return false;
+}
+
+// insertWord() of the word of (key, value), given h == hashKey(hasher, key). a word that isn't inserted was never visible to other threads, so it is released right away
+template <class Slot, class Hash, class Index>
+bool AlgorithmD<Slot, Hash, Index>::insertKey(const int tid, const key_t & key, const value_t & value, const uint32_t h, bool disableExpansion) {
+    const word_t word = slotLayout.make(tid, key, value, h);
+    if(insertWord(tid, word, h, disableExpansion))
+        return true;
+    slotLayout.discard(tid, word);
+    return false;
+}
+
+// semantics: try to insert key. return true if successful (if key doesn't already exist), and false otherwise
+template <class Slot, class Hash, class Index>
+bool AlgorithmD<Slot, Hash, Index>::insertIfAbsent(const int tid, const key_t & key, bool disableExpansion) {
+    return insertKey(tid, key, value_t(), hashKey(hasher, key), disableExpansion);
+}
+
+// semantics: try to insert key with the given value. return true if successful (if key doesn't already exist), and false otherwise
+template <class Slot, class Hash, class Index>
+bool AlgorithmD<Slot, Hash, Index>::insertIfAbsent(const int tid, const key_t & key, const value_t & value, bool disableExpansion) {
+    return insertKey(tid, key, value, hashKey(hasher, key), disableExpansion);
+}
+
+// semantics: try to replace the value associated with key. return true if successful (if key exists), and false otherwise
+template <class Slot, class Hash, class Index>
+bool AlgorithmD<Slot, Hash, Index>::update(const int tid, const key_t & key, const value_t & value) {
+    const uint32_t h = hashKey(hasher, key);
+    const word_t desired = slotLayout.make(tid, key, value, h);
+    if(updateWord(tid, key, desired, h))
+        return true;
+    slotLayout.discard(tid, desired);
+    return false;
+}
+
+// update(), given desired == slotLayout.make(tid, key, value, h)
+template <class Slot, class Hash, class Index>
+bool AlgorithmD<Slot, Hash, Index>::updateWord(const int tid, const key_t & key, const word_t & desired, const uint32_t h) {
+    reclaimer.enter(tid);
+    table * t = currentTable;
+    if(migrating(t)) {
+        helpExpansion(tid, t);
+        word_t found;
+        int index;
+        if(migrating(t) && (index = findInOld(t, key, h, false, found)) >= 0) {
+            // key hasn't been copied into t yet, so update it where it is. once it is frozen, finish its copy and update that instead
+            while(!(found & MARKED_MASK)) {
+                if(found == TOMBSTONE)
+                    return false;
+                else if(t->old[index].compare_exchange_strong(found, desired)) {
+                    retireWord(tid, found);
+                    return true;
+                }
+            }
+            copyFrozen(tid, t, index, found);
+        }
+    }
+    int index = Index::home(h, t->capacity);
+    for(int i = 0; i < t->capacity; i++, index = Index::next(index, t->capacity)) {
+        word_t found = t->data[index];
+        if(found & MARKED_MASK) {
+            STATS stats->markedRetries.inc(tid);
+            return updateWord(tid, key, desired, h);
+        } else if(found == EMPTY) {
+            STATS stats->recordProbe(tid, i + 1);
+            return false;
+        } else if(slotLayout.holds(found, key, h)) {
+            STATS stats->recordProbe(tid, i + 1);
+            // a failed CAS leaves the current word in found: retry while the key is still there, so concurrent updates don't make us report a missing key
+            while(!t->data[index].compare_exchange_strong(found, desired)) {
+                STATS stats->casFailures.inc(tid);
+                if(found & MARKED_MASK) {
+                    STATS stats->markedRetries.inc(tid);
+                    return updateWord(tid, key, desired, h);
+                } else if(found == TOMBSTONE)
+                    return false;
+            }
+            retireWord(tid, found);
+            return true;
+        }
+    }
+    STATS stats->recordProbe(tid, t->capacity);
+    return false;
+}
+
+// semantics: if key exists, copy its value into value and return true. return false otherwise
+template <class Slot, class Hash, class Index>
+bool AlgorithmD<Slot, Hash, Index>::get(const int tid, const key_t & key, value_t & value) {
+    reclaimer.enter(tid);
+    table * t = currentTable;
+    const uint32_t h = hashKey(hasher, key);
+    word_t inOld;
+    if(migrating(t) && findInOld(t, key, h, false, inOld) >= 0) {
+        value = slotLayout.valueOf(inOld & ~MARKED_MASK); // a frozen word is still current until its copy replaces it
+        return true;
+    }
+    int index = Index::home(h, t->capacity);
+    for(int i = 0; i < t->capacity; i++, index = Index::next(index, t->capacity)) {
+        word_t found = t->data[index].load(memory_order_acquire);
+        if(found & MARKED_MASK) {
+            STATS stats->markedRetries.inc(tid);
+            return get(tid, key, value);
+        } else if(found == EMPTY) {
+            STATS stats->recordProbe(tid, i + 1);
+            return false;
+        } else if(slotLayout.holds(found, key, h)) {
+            STATS stats->recordProbe(tid, i + 1);
+            value = slotLayout.valueOf(found);
+            return true;
+        }
+    }
+    STATS stats->recordProbe(tid, t->capacity);
     return false;
 }
 
 // semantics: try to erase key. return true if successful, and false otherwise
-bool AlgorithmD::erase(const int tid, const int & key) {
+template <class Slot, class Hash, class Index>
+bool AlgorithmD<Slot, Hash, Index>::erase(const int tid, const key_t & key) {
+    return eraseHashed(tid, key, hashKey(hasher, key));
+}
+
+// erase(), given h == hashKey(hasher, key)
+template <class Slot, class Hash, class Index>
+bool AlgorithmD<Slot, Hash, Index>::eraseHashed(const int tid, const key_t & key, const uint32_t h) {
+    reclaimer.enter(tid);
     table * t = currentTable;
-    double ii = murmur3(key);
-    uint32_t h = floor(ii / MAXIMUM_HASH * (uint32_t)t->capacity);
-    for(int i = 0; i < t->capacity; i++) {
+    if(migrating(t)) {
         helpExpansion(tid, t);
-        int index = (h + i) % t->capacity;
-        int found = t->data[index];
-        if(found & MARKED_MASK)
-            return erase(tid, key);
-        else if(found == EMPTY)
+        word_t found;
+        int index;
+        if(migrating(t) && (index = findInOld(t, key, h, false, found)) >= 0) {
+            // key hasn't been copied into t yet, so erase it where it is (the migration skips TOMBSTONEs). once it is frozen, finish its copy and erase that instead
+            while(!(found & MARKED_MASK)) {
+                if(found == TOMBSTONE)
+                    return false;
+                else if(t->old[index].compare_exchange_strong(found, TOMBSTONE)) {
+                    retireWord(tid, found);
+                    return true;
+                }
+            }
+            copyFrozen(tid, t, index, found);
+        }
+    }
+    int index = Index::home(h, t->capacity);
+    for(int i = 0; i < t->capacity; i++, index = Index::next(index, t->capacity)) {
+        word_t found = t->data[index];
+        if(found & MARKED_MASK) {
+            STATS stats->markedRetries.inc(tid);
+            return eraseHashed(tid, key, h);
+        } else if(found == EMPTY) {
+            STATS stats->recordProbe(tid, i + 1);
             return false;
-        else if(found == key) {
-            int expected = key;
-            if(t->data[index].compare_exchange_strong(expected, TOMBSTONE)) {
-                t->deleteCounter->inc(tid);
-                return true;
+        } else if(slotLayout.holds(found, key, h)) {
+            STATS stats->recordProbe(tid, i + 1);
+            // the CAS can also fail because a concurrent update() changed the value stored with key, in which case we try again
+            while(!t->data[index].compare_exchange_strong(found, TOMBSTONE)) {
+                STATS stats->casFailures.inc(tid);
+                if(found & MARKED_MASK) {
+                    STATS stats->markedRetries.inc(tid);
+                    return eraseHashed(tid, key, h);
+                } else if(found == TOMBSTONE)
+                    return false;
             }
-            int found = t->data[index];
-            if(found & MARKED_MASK)
-                return erase(tid, key);
-            else if(found == TOMBSTONE);
-                return false;
+            retireWord(tid, found);
+            t->deleteCounter->inc(tid);
+            compactAsNeeded(tid, t);
+            return true;
+        }
+    }
+    STATS stats->recordProbe(tid, t->capacity);
+    return false;
+}
+
+// semantics: return true if key is in the set, and false otherwise
+// a read-only probe: plain atomic loads, no CAS and no helping, also during an expansion (keys that haven't been copied yet are found in t->old, see findInOld)
+template <class Slot, class Hash, class Index>
+bool AlgorithmD<Slot, Hash, Index>::contains(const int tid, const key_t & key) {
+    return containsHashed(tid, key, hashKey(hasher, key));
+}
+
+// contains(), given h == hashKey(hasher, key)
+template <class Slot, class Hash, class Index>
+bool AlgorithmD<Slot, Hash, Index>::containsHashed(const int tid, const key_t & key, const uint32_t h) {
+    reclaimer.enter(tid);
+    table * t = currentTable;
+    // keys of t may still be sitting in t->old, so the probe below could miss them
+    word_t inOld;
+    if(migrating(t) && findInOld(t, key, h, false, inOld) >= 0)
+        return true;
+    int index = Index::home(h, t->capacity);
+    for(int i = 0; i < t->capacity; i++, index = Index::next(index, t->capacity)) {
+        word_t found = t->data[index].load(memory_order_acquire);
+        if(found & MARKED_MASK) {
+            STATS stats->markedRetries.inc(tid);
+            return containsHashed(tid, key, h); // t has been replaced; retry on the newer table
+        } else if(slotLayout.holds(found, key, h) || found == EMPTY) {
+            STATS stats->recordProbe(tid, i + 1);
+            return found != EMPTY;
         }
     }
+    STATS stats->recordProbe(tid, t->capacity);
     return false;
 }
 
-// semantics: return the sum of all KEYS in the set
-int64_t AlgorithmD::getSumOfKeys() {
+/**
+ * runs operation(keys[j], hashKey(hasher, keys[j])) for j = 0..n-1 and stores the results in results[j].
+ * while operation j probes, the keys of operations j+1..j+PREFETCH_DISTANCE have already been hashed and their home slots prefetched,
+ * so a batch keeps up to PREFETCH_DISTANCE cache misses in flight instead of paying them one at a time.
+ */
+template <class Slot, class Hash, class Index>
+template <class Operation>
+void AlgorithmD<Slot, Hash, Index>::pipelineBatch(const int tid, const key_t * keys, bool * results, const int n, const bool forWrite, Operation operation) {
+    uint32_t hashes[PREFETCH_DISTANCE];
+    auto prefetch = [&](const int j) {
+        hashes[j % PREFETCH_DISTANCE] = hashKey(hasher, keys[j]);
+        // protected by the epoch announced by the previous operation (or by the enter() below, for the first PREFETCH_DISTANCE keys)
+        table * t = currentTable;
+        atomic<word_t> * home = &t->data[Index::home(hashes[j % PREFETCH_DISTANCE], t->capacity)];
+        if(forWrite)
+            __builtin_prefetch(home, 1);
+        else
+            __builtin_prefetch(home, 0);
+    };
+    reclaimer.enter(tid);
+    for(int j = 0; j < min(n, (int) PREFETCH_DISTANCE); j++)
+        prefetch(j);
+    for(int j = 0; j < n; j++) {
+        const uint32_t h = hashes[j % PREFETCH_DISTANCE];
+        if(j + PREFETCH_DISTANCE < n)
+            prefetch(j + PREFETCH_DISTANCE);
+        results[j] = operation(keys[j], h);
+    }
+}
+
+// semantics: results[j] = insertIfAbsent(tid, keys[j]) for j = 0..n-1
+template <class Slot, class Hash, class Index>
+void AlgorithmD<Slot, Hash, Index>::insertBatch(const int tid, const key_t * keys, bool * results, const int n) {
+    pipelineBatch(tid, keys, results, n, true, [&](const key_t & key, const uint32_t h) {
+        return insertKey(tid, key, value_t(), h, false);
+    });
+}
+
+// semantics: results[j] = erase(tid, keys[j]) for j = 0..n-1
+template <class Slot, class Hash, class Index>
+void AlgorithmD<Slot, Hash, Index>::eraseBatch(const int tid, const key_t * keys, bool * results, const int n) {
+    pipelineBatch(tid, keys, results, n, true, [&](const key_t & key, const uint32_t h) {
+        return eraseHashed(tid, key, h);
+    });
+}
+
+// semantics: results[j] = contains(tid, keys[j]) for j = 0..n-1
+template <class Slot, class Hash, class Index>
+void AlgorithmD<Slot, Hash, Index>::containsBatch(const int tid, const key_t * keys, bool * results, const int n) {
+    pipelineBatch(tid, keys, results, n, false, [&](const key_t & key, const uint32_t h) {
+        return containsHashed(tid, key, h);
+    });
+}
+
+/**
+ * semantics: call visit(key, value) for every key in the set, from several OpenMP threads at once. weakly consistent, and never waits for other threads:
+ * a key that is in the set for the whole call is visited at least once, and one that is inserted or erased meanwhile may or may not be.
+ * see reduce() for how an expansion is handled. a key is only visited more than once if the table is replaced while we scan it
+ */
+template <class Slot, class Hash, class Index>
+template <class Visit>
+void AlgorithmD<Slot, Hash, Index>::forEach(const int tid, Visit visit) {
+    reduce(tid, 0, [&](const key_t & key, const value_t & value) { visit(key, value); return 0; }, [](const int a, const int b) { return 0; });
+}
+
+/**
+ * semantics: combine the results of map(key, value) for every key in the set, starting from identity and in no particular order (so combine must be associative and commutative).
+ * a key that is in the set for the whole call is counted exactly once, and one that is inserted or erased meanwhile may or may not be.
+ *
+ * if an expansion is in flight, we first move what is left of t->old into t (see finishMigration), so that the parallel scan of t's slot array sees every key.
+ * if t is replaced while we scan it, its keys may be MOVED into the new table before we read them, so we start over on the new table
+ */
+template <class Slot, class Hash, class Index>
+template <class T, class Map, class Combine>
+T AlgorithmD<Slot, Hash, Index>::reduce(const int tid, const T & identity, Map map, Combine combine) {
+    while(true) {
+        reclaimer.enter(tid); // also protects t while the OpenMP threads read it
+        table * t = currentTable;
+        if(migrating(t))
+            finishMigration(tid, t);
+        T scanned = parallelReduce(t->capacity, identity, [&](T & partial, const int i) {
+            word_t word = t->data[i].load(memory_order_acquire) & ~MARKED_MASK; // a frozen word is still current until its copy replaces it
+            if(word == EMPTY || word == TOMBSTONE)
+                return;
+            partial = combine(partial, map(slotLayout.keyOf(word), slotLayout.valueOf(word)));
+        }, combine);
+        if(currentTable == t)
+            return scanned;
+    }
+}
+
+// identifies where keys land in a table of this capacity: a snapshot's slot array can only be used as is by a table whose hasher and indexing put keys in the same slots
+template <class Slot, class Hash, class Index>
+uint64_t AlgorithmD<Slot, Hash, Index>::layoutFingerprint(const int capacity) {
+    uint64_t fingerprint = capacity;
+    for(int k = 1; k <= 64; k++)
+        fingerprint = (fingerprint ^ Index::home(hashKey(hasher, (key_t) k), capacity)) * 0x100000001B3ULL;
+    return fingerprint;
+}
+
+/**
+ * writes the keys (and values) of the table to path: a snapshotHeader, then, at SNAPSHOT_HEADER_BYTES, the slot array of the current table as is (without MARKED bits).
+ * other threads may keep operating on the table meanwhile, which makes this a fuzzy snapshot: a key inserted or erased during the save may or may not be in it,
+ * but every key that is in the set for the whole save is. the slots are copied by all OpenMP threads, which claim chunks of CHUNK_SIZE slots the way migrate() does.
+ * the file is written as path.tmp and renamed to path once complete, so a crash never leaves a torn snapshot at path. returns false (after printing why) on an I/O error
+ */
+template <class Slot, class Hash, class Index>
+bool AlgorithmD<Slot, Hash, Index>::saveSnapshot(const int tid, const char * path) {
+    static_assert(!Slot::OUT_OF_LINE, "a snapshot holds slot words, which must not refer to memory outside the table");
+    const string tmpPath = string(path) + ".tmp";
+    const int fd = open(tmpPath.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0) {
+        cout<<"ERROR: could not create snapshot file "<<tmpPath<<endl;
+        return false;
+    }
+    auto slotOffset = [](const int i) { return (off_t) (SNAPSHOT_HEADER_BYTES + (size_t) i * sizeof(word_t)); };
+    snapshotHeader header = {};
+    atomic<bool> ok(true);
+    while(ok) {
+        reclaimer.enter(tid); // also protects t while the OpenMP threads read it
+        table * t = currentTable;
+        if(migrating(t))
+            finishMigration(tid, t); // keys that are still in t->old have no slot in t's array yet
+        const int numChunks = (t->capacity + CHUNK_SIZE - 1) / CHUNK_SIZE;
+        atomic<int> chunksClaimed(0);
+        int64_t live = 0, tombstones = 0;
+        #pragma omp parallel reduction(+:live, tombstones)
+        {
+            vector<word_t> buffer(CHUNK_SIZE);
+            for(int myChunk = chunksClaimed.fetch_add(1); myChunk < numChunks && ok; myChunk = chunksClaimed.fetch_add(1)) {
+                const int start = myChunk * CHUNK_SIZE;
+                const int end = min(start + CHUNK_SIZE, t->capacity);
+                // a slot only goes from EMPTY to a key to TOMBSTONE, and an insert only passes slots that are no longer EMPTY. reading the chunk backwards (against the
+                // direction of probing) therefore never saves a key behind an EMPTY it had to probe past: that slot is read later, when it isn't EMPTY any more
+                for(int i = end - 1; i >= start; i--) {
+                    word_t word = t->data[i].load(memory_order_acquire) & ~MARKED_MASK;
+                    if(word == TOMBSTONE) tombstones++;
+                    else if(word != EMPTY) live++;
+                    buffer[i - start] = word;
+                }
+                if(!pwriteAll(fd, buffer.data(), (end - start) * sizeof(word_t), slotOffset(start)))
+                    ok = false;
+            }
+        }
+        if(!ok || currentTable != t)
+            continue; // t was replaced while we copied it, so keys may have been MOVED out of slots before we read them: copy the new table instead
+
+        // across chunk boundaries there is no such order, since other threads copied the chunk before. so for each key at the start of a chunk whose probe began
+        // in an earlier one, save the EMPTY slots we read on its way as TOMBSTONEs. there we may also find the same key, read before it was erased and inserted again
+        // (it is in no other slot of its own chunk, for the same reason): keep that copy instead. only the keys in the first run of non-EMPTY slots of a chunk can be such keys
+        const int capacity = t->capacity;
+        auto readSaved = [&](const int i) {
+            word_t word = EMPTY;
+            if(!preadAll(fd, &word, sizeof(word), slotOffset(i))) ok = false;
+            return word;
+        };
+        for(int c = 0; c < numChunks && ok; c++) {
+            const int start = c * CHUNK_SIZE;
+            const int end = min(start + CHUNK_SIZE, capacity);
+            for(int j = start; j < end && ok; j++) {
+                const word_t word = readSaved(j);
+                if(word == EMPTY)
+                    break;
+                else if(word == TOMBSTONE)
+                    continue;
+                const int home = Index::home(slotLayout.hashOf(word, hasher), capacity);
+                if(((int64_t) j - home + capacity) % capacity <= j - start)
+                    continue; // its probe began in this chunk
+                const word_t tombstone = TOMBSTONE;
+                for(int i = home; i != start && ok; i = Index::next(i, capacity)) {
+                    const word_t found = readSaved(i);
+                    if(found == EMPTY) {
+                        ok = pwriteAll(fd, &tombstone, sizeof(tombstone), slotOffset(i));
+                        tombstones++;
+                    } else if(found != TOMBSTONE && slotLayout.sameKey(found, word)) {
+                        ok = pwriteAll(fd, &tombstone, sizeof(tombstone), slotOffset(j));
+                        live--;
+                        tombstones++;
+                        break;
+                    }
+                }
+            }
+        }
+        memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+        header.wordBytes = sizeof(word_t);
+        header.capacity = capacity;
+        header.live = live;
+        header.tombstones = tombstones;
+        header.layout = layoutFingerprint(capacity);
+        break;
+    }
+    // the tables we copied before the last one may have been larger
+    ok = ok && pwriteAll(fd, &header, sizeof(header), 0) && !ftruncate(fd, slotOffset(header.capacity)) && !fsync(fd);
+    ok = !close(fd) && ok && !rename(tmpPath.c_str(), path);
+    if(!ok) {
+        cout<<"ERROR: could not write snapshot file "<<path<<endl;
+        unlink(tmpPath.c_str());
+    }
+    return ok;
+}
+
+/**
+ * replaces the contents of the table with the snapshot at path (see saveSnapshot). not thread safe: no other thread may use the table meanwhile (e.g., call it right after construction).
+ * if the snapshot's slots are where this table would put them (its capacity is one our indexing allows, and our hasher puts keys in the same slots), the file is mapped
+ * as the table's slot array: pages are read in as operations first touch them and copied privately when written, so loading takes the same time for any size.
+ * such a table isn't allocated according to the memoryPolicy, but the tables that replace it are. otherwise the live keys of the snapshot are read by all OpenMP threads
+ * and rehashed into a new table like the bulk-load constructor's. returns false (after printing why, and leaving the table as it was) if path isn't a snapshot of this kind of table
+ */
+template <class Slot, class Hash, class Index>
+bool AlgorithmD<Slot, Hash, Index>::loadSnapshot(const char * path) {
+    static_assert(!Slot::OUT_OF_LINE, "a snapshot holds slot words, which must not refer to memory outside the table");
+    const int fd = open(path, O_RDONLY);
+    if(fd < 0) {
+        cout<<"ERROR: could not open snapshot file "<<path<<endl;
+        return false;
+    }
+    snapshotHeader header;
+    struct stat st;
+    if(!preadAll(fd, &header, sizeof(header), 0) || memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) || header.wordBytes != sizeof(word_t)
+            || header.capacity <= 0 || header.capacity > numeric_limits<int>::max() || fstat(fd, &st)
+            || (size_t) st.st_size < SNAPSHOT_HEADER_BYTES + (size_t) header.capacity * sizeof(word_t)) {
+        cout<<"ERROR: "<<path<<" is not a snapshot of this kind of table"<<endl;
+        close(fd);
+        return false;
+    }
+    const int capacity = header.capacity;
+    table * current = currentTable;
+    table * t = NULL;
+    if(Index::roundCapacity(capacity) == capacity && header.layout == layoutFingerprint(capacity) && SNAPSHOT_HEADER_BYTES % sysconf(_SC_PAGESIZE) == 0) {
+        void * p = mmap(NULL, (size_t) capacity * sizeof(word_t), PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, SNAPSHOT_HEADER_BYTES);
+        if(p != MAP_FAILED) {
+            t = new table(capacity, numThreads, current->memory, (atomic<word_t> *) p);
+            // as if the table had been filled by operations: every tombstone was inserted once, then erased
+            t->approxCounter->add(header.live + header.tombstones);
+            t->deleteCounter->add(header.tombstones);
+        }
+    }
+    if(!t) {
+        const int numChunks = (capacity + CHUNK_SIZE - 1) / CHUNK_SIZE;
+        vector<vector<word_t>> liveOfThread(omp_get_max_threads());
+        atomic<bool> ok(true);
+        #pragma omp parallel
+        {
+            vector<word_t> buffer(CHUNK_SIZE);
+            vector<word_t> & mine = liveOfThread[omp_get_thread_num()];
+            #pragma omp for schedule(dynamic)
+            for(int c = 0; c < numChunks; c++) {
+                const int start = c * CHUNK_SIZE;
+                const int end = min(start + CHUNK_SIZE, capacity);
+                if(!preadAll(fd, buffer.data(), (end - start) * sizeof(word_t), SNAPSHOT_HEADER_BYTES + (size_t) start * sizeof(word_t))) {
+                    ok = false;
+                    continue;
+                }
+                for(int i = 0; i < end - start; i++)
+                    if(buffer[i] != EMPTY && buffer[i] != TOMBSTONE)
+                        mine.push_back(buffer[i]);
+            }
+        }
+        if(!ok) {
+            cout<<"ERROR: could not read snapshot file "<<path<<endl;
+            close(fd);
+            return false;
+        }
+        vector<word_t> words;
+        words.reserve(header.live);
+        for(auto & wordsOfThread : liveOfThread)
+            words.insert(words.end(), wordsOfThread.begin(), wordsOfThread.end());
+        t = new table(max(capacityFor(words.size(), resize), minCapacity), numThreads, current->memory);
+        bulkFill(t, span<const word_t>(words), [&](const word_t & word) { return slotLayout.keyOf(word); }, [](const word_t & word, const uint32_t h) { return word; });
+    }
+    close(fd); // a mapping stays valid after its file is closed
+    if(current->prev)
+        delete current->prev;
+    delete current;
+    currentTable = t;
+    recordPublished(t);
+    return true;
+}
+
+// semantics: return the sum of all KEYS in the set (of their keyChecksum(), for keys that aren't integers)
+template <class Slot, class Hash, class Index>
+int64_t AlgorithmD<Slot, Hash, Index>::getSumOfKeys() {
     int64_t sum = 0;
     table * table = currentTable;
     for(int i = 0; i < table->capacity; i++) {
-        int key = table->data[i];
-        if(key != EMPTY && key != TOMBSTONE)
-            sum += key;
+        word_t word = table->data[i];
+        if(word != EMPTY && word != TOMBSTONE)
+            sum += keyChecksum(slotLayout.keyOf(word));
+    }
+    if(migrating(table)) {
+        // keys that haven't been copied out of the old array yet
+        for(int i = 0; i < table->oldCapacity; i++) {
+            word_t word = table->old[i] & ~MARKED_MASK;
+            if(word != EMPTY && word != TOMBSTONE)
+                sum += keyChecksum(slotLayout.keyOf(word));
+        }
     }
     return sum;
 }
 
+// a new table t was just published: until its migration is done, the set uses both its slots and those of the table it replaced (t->oldCapacity, which,
+// unlike t->prev, doesn't change when the migration ends)
+template <class Slot, class Hash, class Index>
+void AlgorithmD<Slot, Hash, Index>::recordPublished(table * t) {
+    const size_t bytes = ((size_t) t->capacity + t->oldCapacity) * sizeof(word_t);
+    size_t peak = peakBytes.load(memory_order_relaxed);
+    while(bytes > peak && !peakBytes.compare_exchange_weak(peak, bytes)) {}
+}
+
+// semantics: return the number of bytes of slot arrays the set uses: those of its table, plus those of the old table while keys are being migrated out of it.
+// like getSumOfKeys(), meant for when no other thread is operating on the set
+template <class Slot, class Hash, class Index>
+size_t AlgorithmD<Slot, Hash, Index>::tableBytes() {
+    table * t = currentTable;
+    return ((size_t) t->capacity + (migrating(t) ? t->oldCapacity : 0)) * sizeof(word_t);
+}
+
+// semantics: return the most bytes of slot arrays the set has used at once since it was constructed (sampled whenever a table is published, when both it and the table it replaces are allocated)
+template <class Slot, class Hash, class Index>
+size_t AlgorithmD<Slot, Hash, Index>::peakTableBytes() {
+    return peakBytes.load();
+}
+
 // print any debugging details you want at the end of a trial in this function
-void AlgorithmD::printDebuggingDetails() {
-}
\ No newline at end of file
+template <class Slot, class Hash, class Index>
+void AlgorithmD<Slot, Hash, Index>::printDebuggingDetails() {
+    STATS {
+        table * t = currentTable;
+        // frozen (MARKED) words still count as what they were before they were frozen
+        auto count = [](atomic<word_t> * slots, const int capacity, const char * name) {
+            long long live = 0, tombstones = 0, empty = 0;
+            for(int i = 0; i < capacity; i++) {
+                word_t word = slots[i] & ~MARKED_MASK;
+                if(word == EMPTY) empty++;
+                else if(word == TOMBSTONE) tombstones++;
+                else live++;
+            }
+            hashStats::printSlotCounts(name, live, tombstones, empty);
+        };
+        count(t->data, t->capacity, "table");
+        if(migrating(t))
+            count(t->old, t->oldCapacity, "old table (still migrating)"); // MOVED slots count as tombstones
+        stats->print(numThreads);
+    }
+}
@@ -0,0 +1,33 @@
+#pragma once
+#include "alg_d.h"
+using namespace std;
+
+/**
+ * slot layout of the key-value map variant of AlgorithmD: the key lives in the upper 32 bits and its value in the lower 32 bits of one 64-bit word.
+ * a (key, value) pair is therefore read, inserted, updated and migrated with a single atomic load/CAS, and a probe touches one cache line per slot just like the set.
+ * keys follow the same rules as KeySlot (the largest "real" key is 0x7FFFFFFE, and the smallest is 1); values can be any 32-bit unsigned integer.
+ */
+struct KeyValueSlot {
+    typedef uint64_t word_t;
+    typedef int key_t;
+    typedef uint32_t value_t;
+
+    static constexpr word_t MARKED_MASK = (word_t) 1 << 63;             // most significant bit of the key half
+    static constexpr word_t TOMBSTONE = (word_t) 0x7FFFFFFF << 32;      // key half is the largest value that doesn't use bit MARKED_MASK
+    static constexpr word_t EMPTY = (word_t) 0;
+    static constexpr bool OUT_OF_LINE = false;
+    static constexpr bool RECLAIM_RECORDS = false;
+
+    static word_t make(const int tid, const key_t key, const value_t value, const uint32_t h) { return ((word_t) (uint32_t) key << 32) | value; }
+    static key_t keyOf(const word_t word) { return (key_t) (word >> 32); }
+    static value_t valueOf(const word_t word) { return (value_t) word; }
+    template <class Hash>
+    static uint32_t hashOf(const word_t word, const Hash & hasher) { return hashKey(hasher, keyOf(word)); }
+    static bool holds(const word_t word, const key_t & key, const uint32_t h) { return keyOf(word) == key; }
+    static bool sameKey(const word_t word, const word_t other) { return keyOf(word) == keyOf(other); }
+    static void discard(const int tid, const word_t word) {}
+    static void release(const word_t word) {}
+};
+
+template <class Hash = Murmur3Finalizer, class Index = FastRangeIndexing>
+using AlgorithmDMap = AlgorithmD<KeyValueSlot, Hash, Index>;
@@ -0,0 +1,134 @@
+#pragma once
+#include "alg_d.h"
+#include <string_view>
+using namespace std;
+
+/**
+ * slot layout of AlgorithmD for a set of strings of any length (e.g., URLs to dedupe), passed in and out as string_views.
+ * the bytes of a key are copied once, by the thread that inserts it, into that thread's part of a bump-allocated arena, and the 64-bit slot word holds
+ * the key's whole 32-bit hash beside the arena offset of those bytes:
+ *
+ *   bit 63: MARKED_MASK | bits 31..62: hashKey() of the key | bits 0..30: offset of the key in the arena, in units of 8 bytes (so at most 16 GB of keys)
+ *
+ * a probe compares the bytes of a key only when the hash in the word matches, and a migration places each word by that hash, so resizing moves
+ * slot words and never reads (or copies) key bytes. the bytes of an erased key stay in the arena until the set is destroyed, which also keeps
+ * every string_view handed to a concurrent operation valid; the bytes of a key that turns out to be present already are given back.
+ */
+class StringSlot {
+public:
+    typedef uint64_t word_t;
+    typedef string_view key_t;
+    typedef int value_t;                                    // a set has no values
+
+    static constexpr word_t MARKED_MASK = (word_t) 1 << 63;
+    static constexpr word_t TOMBSTONE = (word_t) 1;         // block 0 of the arena is never allocated, so no key is at offset 0 or 1
+    static constexpr word_t EMPTY = (word_t) 0;
+    static constexpr bool OUT_OF_LINE = true;
+    static constexpr bool RECLAIM_RECORDS = false;          // the arena is freed as a whole
+
+private:
+    static constexpr int HASH_SHIFT = 31;
+    static constexpr word_t OFFSET_MASK = ((word_t) 1 << HASH_SHIFT) - 1;
+    static constexpr size_t UNIT_BYTES = 8;                 // keys start at multiples of this
+    static constexpr int BLOCK_SHIFT = 19;                  // the arena is allocated in blocks of 2^19 units (4 MB)
+    static constexpr word_t BLOCK_UNITS = (word_t) 1 << BLOCK_SHIFT;
+    static constexpr int MAX_BLOCKS = 1 << (HASH_SHIFT - BLOCK_SHIFT);
+
+    // the units [next, end) of its current block that a thread can still allocate
+    struct PaddedArena {
+        word_t next;
+        word_t end;
+        vector<char *> allocations;
+        char padding[PADDING_BYTES];
+    };
+
+    char * blocks[MAX_BLOCKS];          // block b holds units [b * BLOCK_UNITS, (b + 1) * BLOCK_UNITS). another thread only reads blocks[b] after loading a word that refers to it
+    atomic<int> blocksClaimed;
+    PaddedArena * arenas;               // one per tid (MAX_THREADS of them, since the bulk-load constructor allocates with OpenMP thread numbers)
+
+    char * recordAt(const word_t offset) const {
+        return blocks[offset >> BLOCK_SHIFT] + (offset & (BLOCK_UNITS - 1)) * UNIT_BYTES;
+    }
+
+    // a key is stored as its uint32_t length followed by its bytes
+    static word_t unitsOf(const size_t length) {
+        return (sizeof(uint32_t) + length + UNIT_BYTES - 1) / UNIT_BYTES;
+    }
+
+    // returns the offset of units free units of thread tid's arena. a key larger than a quarter of a block gets blocks of its own, so the rest of the current block isn't wasted
+    word_t allocate(const int tid, const word_t units) {
+        PaddedArena & arena = arenas[tid];
+        if(arena.next + units <= arena.end) {
+            arena.next += units;
+            return arena.next - units;
+        }
+        const int numBlocks = (units + BLOCK_UNITS - 1) / BLOCK_UNITS;
+        const int first = blocksClaimed.fetch_add(numBlocks);
+        if(first + numBlocks > MAX_BLOCKS)
+            throw bad_alloc();
+        char * memory = (char *) malloc(numBlocks * BLOCK_UNITS * UNIT_BYTES);
+        if(!memory)
+            throw bad_alloc();
+        arena.allocations.push_back(memory);
+        for(int b = 0; b < numBlocks; b++)
+            blocks[first + b] = memory + b * BLOCK_UNITS * UNIT_BYTES;
+        const word_t start = (word_t) first << BLOCK_SHIFT;
+        if(units <= BLOCK_UNITS / 4) {
+            arena.next = start + units;
+            arena.end = start + BLOCK_UNITS;
+        }
+        return start;
+    }
+
+public:
+    StringSlot() : blocksClaimed(1) {
+        blocks[0] = NULL;
+        arenas = new PaddedArena[MAX_THREADS];
+        for(int tid = 0; tid < MAX_THREADS; tid++)
+            arenas[tid].next = arenas[tid].end = 0;
+    }
+    StringSlot(const StringSlot &) = delete;
+    ~StringSlot() {
+        for(int tid = 0; tid < MAX_THREADS; tid++)
+            for(char * memory : arenas[tid].allocations)
+                free(memory);
+        delete[] arenas;
+    }
+
+    word_t make(const int tid, const key_t & key, const value_t value, const uint32_t h) {
+        if(key.size() > numeric_limits<uint32_t>::max())
+            throw length_error("StringSlot keys are at most 4 GB");
+        const uint32_t length = key.size();
+        const word_t offset = allocate(tid, unitsOf(length));
+        char * record = recordAt(offset);
+        memcpy(record, &length, sizeof(length));
+        memcpy(record + sizeof(length), key.data(), length);
+        return ((word_t) h << HASH_SHIFT) | offset;
+    }
+    key_t keyOf(const word_t word) const {
+        const char * record = recordAt(word & OFFSET_MASK);
+        uint32_t length;
+        memcpy(&length, record, sizeof(length));
+        return string_view(record + sizeof(length), length);
+    }
+    static value_t valueOf(const word_t word) { return 0; }
+    template <class Hash>
+    static uint32_t hashOf(const word_t word, const Hash & hasher) { return (uint32_t) ((word & ~MARKED_MASK) >> HASH_SHIFT); }
+    // a MARKED word never holds key: its top bit makes the hash part differ
+    bool holds(const word_t word, const key_t & key, const uint32_t h) const {
+        return (word & ~OFFSET_MASK) == ((word_t) h << HASH_SHIFT) && (word & OFFSET_MASK) > TOMBSTONE && keyOf(word) == key;
+    }
+    bool sameKey(const word_t word, const word_t other) const {
+        return word == other || ((word & ~OFFSET_MASK) == (other & ~OFFSET_MASK) && (word & OFFSET_MASK) > TOMBSTONE && keyOf(word) == keyOf(other));
+    }
+    // the key was the last one thread tid allocated (unless its bytes got blocks of their own), so its units are simply handed back
+    void discard(const int tid, const word_t word) {
+        const word_t offset = word & OFFSET_MASK;
+        if(offset + unitsOf(keyOf(word).size()) == arenas[tid].next)
+            arenas[tid].next = offset;
+    }
+    static void release(const word_t word) {}
+};
+
+template <class Hash = Murmur3Finalizer, class Index = FastRangeIndexing>
+using AlgorithmDString = AlgorithmD<StringSlot, Hash, Index>;
@@ -0,0 +1,59 @@
+#pragma once
+#include "alg_d.h"
+using namespace std;
+
+/**
+ * slot layout of AlgorithmD for keys that don't fit in a word beside MARKED_MASK and the two sentinels, such as 64-bit hashes and 16-byte UUIDs (fixedKey<16>).
+ * the (key, value) pair lives in an immutable record, and the 64-bit slot word holds a pointer to it plus a 15-bit fingerprint of the key's hash:
+ *
+ *   bit 63: MARKED_MASK | bits 48..62: fingerprint | bits 0..47: record pointer (user space addresses fit in 48 bits on x86-64 and aarch64)
+ *
+ * so a slot is still read, inserted, migrated and erased with a single-word CAS, and every value of Key is a valid key: the sentinels are the pointers 0 and 1.
+ * a probe only dereferences the record of a word whose fingerprint matches (1 in 32768 of the other keys it passes).
+ * update() installs a new record, and the records that erase() and update() replace are freed by AlgorithmD's epoch reclaimer, since other threads may still be reading them.
+ * snapshots (which copy slot words to a file) are not supported.
+ */
+template <class Key, class Value = int>
+struct IndirectSlot {
+    typedef uint64_t word_t;
+    typedef Key key_t;
+    typedef Value value_t;
+
+    struct record {
+        Key key;
+        Value value;
+    };
+
+    static constexpr word_t MARKED_MASK = (word_t) 1 << 63;
+    static constexpr word_t TOMBSTONE = (word_t) 1;                     // no record is at address 1
+    static constexpr word_t EMPTY = (word_t) 0;
+    static constexpr bool OUT_OF_LINE = true;
+    static constexpr bool RECLAIM_RECORDS = true;
+    static constexpr word_t POINTER_MASK = ((word_t) 1 << 48) - 1;
+
+    static word_t fingerprintOf(const uint32_t h) {
+        return (word_t) ((h * 0x9E3779B1u) >> 17) << 48;                // the top 15 bits of a multiplicative rehash, since the indexing policies use the bits of h themselves
+    }
+    static record * recordOf(const word_t word) { return (record *) (word & POINTER_MASK); }
+
+    static word_t make(const int tid, const key_t & key, const value_t & value, const uint32_t h) { return fingerprintOf(h) | (word_t) new record { key, value }; }
+    static key_t keyOf(const word_t word) { return recordOf(word)->key; }
+    static value_t valueOf(const word_t word) { return recordOf(word)->value; }
+    template <class Hash>
+    static uint32_t hashOf(const word_t word, const Hash & hasher) { return hashKey(hasher, keyOf(word)); }
+    // a MARKED word never holds key, as with KeySlot: its top bit makes the fingerprint differ
+    static bool holds(const word_t word, const key_t & key, const uint32_t h) {
+        return (word & ~POINTER_MASK) == fingerprintOf(h) && (word & POINTER_MASK) > TOMBSTONE && recordOf(word)->key == key;
+    }
+    static bool sameKey(const word_t word, const word_t other) {
+        return (word & ~POINTER_MASK) == (other & ~POINTER_MASK) && (word & POINTER_MASK) > TOMBSTONE && recordOf(word)->key == recordOf(other)->key;
+    }
+    static void discard(const int tid, const word_t word) { release(word); }
+    static void release(const word_t word) { delete recordOf(word); }
+};
+
+template <class Key, class Hash = Murmur3Finalizer, class Index = FastRangeIndexing>
+using AlgorithmDWide = AlgorithmD<IndirectSlot<Key>, Hash, Index>;
+
+template <class Key, class Value, class Hash = Murmur3Finalizer, class Index = FastRangeIndexing>
+using AlgorithmDWideMap = AlgorithmD<IndirectSlot<Key, Value>, Hash, Index>;
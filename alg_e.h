@@ -0,0 +1,234 @@
+#pragma once
+#include "util.h"
+#include <atomic>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+using namespace std;
+
+/**
+ * lock-free non-expandable hash table like AlgorithmC, but keys are stored in groups of 16 that fill exactly one cache line.
+ * a probe step examines a whole group: one SIMD comparison (2 x AVX2 or 4 x SSE2) finds every lane holding the key and every EMPTY lane,
+ * so at high load factors a long probe sequence costs one cache miss per 16 slots instead of one per slot.
+ * inserts still claim an individual lane with a CAS, and erase still CASes a lane to TOMBSTONE.
+ * as in AlgorithmC, tombstones are never reused (an insert only claims EMPTY lanes, so that two inserts of a key can't both succeed), so a table under
+ * churn fills up with them: probes lengthen towards the whole table, and inserts fail once no EMPTY lane is left.
+ */
+template <class Hash = Murmur3Finalizer, class Index = FastRangeIndexing>
+class AlgorithmE {
+public:
+    static constexpr int TOMBSTONE = -1;
+    static constexpr int NULL_VALUE = -2;
+    static constexpr int GROUP_SIZE = 16;
+
+    char padding0[PADDING_BYTES];
+    const int numThreads;
+    int capacity;                       // in slots (numGroups * GROUP_SIZE)
+    int numGroups;
+    Hash hasher;
+    hashStats * stats;                  // NULL unless built with STATS. probe lengths are counted in groups
+    char padding2[PADDING_BYTES];
+
+    struct alignas(64) group {
+        atomic<int> keys[GROUP_SIZE];
+    };
+
+    group * data;
+
+    AlgorithmE(const int _numThreads, const int _capacity);
+    ~AlgorithmE();
+    bool insertIfAbsent(const int tid, const int & key);
+    bool erase(const int tid, const int & key);
+    bool contains(const int tid, const int & key);
+    template <class Visit>
+    void forEach(const int tid, Visit visit);
+    template <class T, class Map, class Combine>
+    T reduce(const int tid, const T & identity, Map map, Combine combine);
+    long getSumOfKeys();
+    void printDebuggingDetails();
+
+private:
+    // bit i of keyMask (resp. emptyMask) is set iff lane i of g holds key (resp. NULL_VALUE)
+    static void match(const group * g, const int key, uint32_t & keyMask, uint32_t & emptyMask);
+};
+
+/**
+ * constructor: initialize the hash table's internals
+ *
+ * @param _numThreads maximum number of threads that will ever use the hash table (i.e., at least tid+1, where tid is the largest thread ID passed to any function of this class)
+ * @param _capacity is the INITIAL size of the hash table (maximum number of elements it can contain WITHOUT expansion)
+ */
+template <class Hash, class Index>
+AlgorithmE<Hash, Index>::AlgorithmE(const int _numThreads, const int _capacity)
+: numThreads(_numThreads), numGroups(Index::roundCapacity((_capacity + GROUP_SIZE - 1) / GROUP_SIZE)), stats(NULL) {
+    capacity = numGroups * GROUP_SIZE;
+    data = new group[numGroups];
+    for(int i = 0; i < numGroups; i++)
+        for(int j = 0; j < GROUP_SIZE; j++)
+            data[i].keys[j].store(NULL_VALUE, memory_order_relaxed);
+    STATS stats = new hashStats();
+}
+
+// destructor: clean up any allocated memory, etc.
+template <class Hash, class Index>
+AlgorithmE<Hash, Index>::~AlgorithmE() {
+    delete[] data;
+    delete stats;
+}
+
+template <class Hash, class Index>
+void AlgorithmE<Hash, Index>::match(const group * g, const int key, uint32_t & keyMask, uint32_t & emptyMask) {
+    // every lane is read atomically (aligned 4-byte lanes), but not the group as a whole. that is fine: it is equivalent to reading the lanes one at a time
+#if defined(__AVX2__)
+    const __m256i k = _mm256_set1_epi32(key);
+    const __m256i e = _mm256_set1_epi32(NULL_VALUE);
+    const __m256i lo = _mm256_load_si256((const __m256i *) &g->keys[0]);
+    const __m256i hi = _mm256_load_si256((const __m256i *) &g->keys[8]);
+    atomic_thread_fence(memory_order_acquire);
+    keyMask = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(lo, k)))
+            | (_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(hi, k))) << 8);
+    emptyMask = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(lo, e)))
+              | (_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(hi, e))) << 8);
+#elif defined(__SSE2__)
+    const __m128i k = _mm_set1_epi32(key);
+    const __m128i e = _mm_set1_epi32(NULL_VALUE);
+    keyMask = 0;
+    emptyMask = 0;
+    for(int q = 0; q < GROUP_SIZE / 4; q++) {
+        const __m128i lanes = _mm_load_si128((const __m128i *) &g->keys[4 * q]);
+        keyMask |= _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(lanes, k))) << (4 * q);
+        emptyMask |= _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(lanes, e))) << (4 * q);
+    }
+    atomic_thread_fence(memory_order_acquire);
+#else
+    keyMask = 0;
+    emptyMask = 0;
+    for(int j = 0; j < GROUP_SIZE; j++) {
+        int found = g->keys[j].load(memory_order_acquire);
+        keyMask |= (uint32_t) (found == key) << j;
+        emptyMask |= (uint32_t) (found == NULL_VALUE) << j;
+    }
+#endif
+}
+
+// semantics: try to insert key. return true if successful (if key doesn't already exist), and false otherwise
+template <class Hash, class Index>
+bool AlgorithmE<Hash, Index>::insertIfAbsent(const int tid, const int & key) {
+    int index = Index::home(hasher(key), numGroups);
+    for(int i = 0; i < numGroups; i++, index = Index::next(index, numGroups)) {
+        group * g = &data[index];
+        uint32_t keyMask, emptyMask;
+        match(g, key, keyMask, emptyMask);
+        while(!keyMask && emptyMask) {
+            // the key isn't in this group, and since lanes never become EMPTY again it can't be in a later one either: claim the first EMPTY lane
+            int lane = __builtin_ctz(emptyMask);
+            int expected = NULL_VALUE;
+            if(g->keys[lane].compare_exchange_strong(expected, key)) {
+                STATS stats->recordProbe(tid, i + 1);
+                return true;
+            }
+            STATS stats->casFailures.inc(tid);
+            if(expected == key) {
+                STATS stats->recordProbe(tid, i + 1);
+                return false;
+            }
+            match(g, key, keyMask, emptyMask);
+        }
+        if(keyMask) {
+            STATS stats->recordProbe(tid, i + 1);
+            return false;
+        }
+    }
+    STATS stats->recordProbe(tid, numGroups);
+    return false;
+}
+
+// semantics: try to erase key. return true if successful, and false otherwise
+template <class Hash, class Index>
+bool AlgorithmE<Hash, Index>::erase(const int tid, const int & key) {
+    int index = Index::home(hasher(key), numGroups);
+    for(int i = 0; i < numGroups; i++, index = Index::next(index, numGroups)) {
+        group * g = &data[index];
+        uint32_t keyMask, emptyMask;
+        match(g, key, keyMask, emptyMask);
+        if(keyMask || emptyMask)
+            STATS stats->recordProbe(tid, i + 1);
+        if(keyMask) {
+            int expected = key;
+            if(g->keys[__builtin_ctz(keyMask)].compare_exchange_strong(expected, TOMBSTONE))
+                return true;
+            STATS stats->casFailures.inc(tid);
+            return false;
+        } else if(emptyMask) {
+            return false;
+        }
+    }
+    STATS stats->recordProbe(tid, numGroups);
+    return false;
+}
+
+// semantics: return true if key is in the set, and false otherwise (read-only: one SIMD scan per group, no CAS)
+template <class Hash, class Index>
+bool AlgorithmE<Hash, Index>::contains(const int tid, const int & key) {
+    int index = Index::home(hasher(key), numGroups);
+    for(int i = 0; i < numGroups; i++, index = Index::next(index, numGroups)) {
+        uint32_t keyMask, emptyMask;
+        match(&data[index], key, keyMask, emptyMask);
+        if(keyMask || emptyMask) {
+            STATS stats->recordProbe(tid, i + 1);
+            return keyMask != 0;
+        }
+    }
+    STATS stats->recordProbe(tid, numGroups);
+    return false;
+}
+
+/**
+ * semantics: call visit(key) for every key in the set, from several OpenMP threads at once. weakly consistent, and never blocks (or is blocked by) operations:
+ * a key that is in the set for the whole call is visited exactly once, and one that is inserted or erased meanwhile may or may not be
+ */
+template <class Hash, class Index>
+template <class Visit>
+void AlgorithmE<Hash, Index>::forEach(const int tid, Visit visit) {
+    parallelFor(capacity, [&](const int i) {
+        int key = data[i / GROUP_SIZE].keys[i % GROUP_SIZE].load(memory_order_acquire);
+        if(key != NULL_VALUE && key != TOMBSTONE)
+            visit(key);
+    });
+}
+
+// semantics: combine the results of map(key) for every key in the set, starting from identity and in no particular order (so combine must be associative and commutative). scans like forEach()
+template <class Hash, class Index>
+template <class T, class Map, class Combine>
+T AlgorithmE<Hash, Index>::reduce(const int tid, const T & identity, Map map, Combine combine) {
+    return parallelReduce(capacity, identity, [&](T & partial, const int i) {
+        int key = data[i / GROUP_SIZE].keys[i % GROUP_SIZE].load(memory_order_acquire);
+        if(key != NULL_VALUE && key != TOMBSTONE)
+            partial = combine(partial, map(key));
+    }, combine);
+}
+
+// semantics: return the sum of all KEYS in the set
+template <class Hash, class Index>
+int64_t AlgorithmE<Hash, Index>::getSumOfKeys() {
+    return reduce(0, (int64_t) 0, [](const int & key) { return (int64_t) key; }, [](const int64_t a, const int64_t b) { return a + b; });
+}
+
+// print any debugging details you want at the end of a trial in this function
+template <class Hash, class Index>
+void AlgorithmE<Hash, Index>::printDebuggingDetails() {
+    STATS {
+        long long live = 0, tombstones = 0;
+        for(int i = 0; i < numGroups; i++) {
+            for(int j = 0; j < GROUP_SIZE; j++) {
+                int key = data[i].keys[j];
+                if(key == TOMBSTONE) tombstones++;
+                else if(key != NULL_VALUE) live++;
+            }
+        }
+        hashStats::printSlotCounts("table", live, tombstones, capacity - live - tombstones);
+        stats->print(numThreads);
+    }
+}
@@ -0,0 +1,301 @@
+#pragma once
+#include "util.h"
+#include <atomic>
+using namespace std;
+
+/**
+ * non-expandable bucketized cuckoo hash table. every key has two candidate buckets, and is in one of them, so an operation reads at most two buckets.
+ * a bucket is one cache line: a seqLock and BUCKET_SLOTS keys, so a lookup touches at most two cache lines however full the table is.
+ * when both buckets of a new key are full, insert searches (breadth first, without locks) for a path of keys that can each move to their other bucket,
+ * ending at a bucket with an EMPTY slot, and moves them one at a time starting from that end, which frees a slot in one of the new key's buckets.
+ * buckets of 15 slots let the table fill to well above 90% before an insert finds no such path and fails (returns false).
+ *
+ * insert, erase and every move lock the (two) buckets they modify, in increasing order. contains() doesn't lock: it reads both buckets of the key
+ * and rereads them if a writer changed either one meanwhile, so it never misses a key that is being moved between them.
+ */
+template <class Hash = Murmur3Finalizer, class Index = FastRangeIndexing>
+class AlgorithmK {
+public:
+    static constexpr int NULL_VALUE = -2;          // every other int is a valid key (slots are emptied again on erase, so there are no tombstones)
+    static constexpr int BUCKET_SLOTS = 15;
+    static constexpr int MAX_SEARCH = 512;         // buckets an insert examines looking for a cuckoo path
+
+    char padding0[PADDING_BYTES];
+    const int numThreads;
+    int capacity;                       // in slots (numBuckets * BUCKET_SLOTS)
+    int numBuckets;
+    Hash hasher;
+    hashStats * stats;                  // NULL unless built with STATS. probe lengths are counted in buckets (for inserts, plus the keys moved), cas failures are cuckoo paths that changed before they were moved
+    char padding2[PADDING_BYTES];
+
+    struct alignas(64) bucket {
+        seqLock lock;
+        atomic<int> keys[BUCKET_SLOTS];
+    };
+
+    bucket * data;
+
+    AlgorithmK(const int _numThreads, const int _capacity);
+    ~AlgorithmK();
+    bool insertIfAbsent(const int tid, const int & key);
+    bool erase(const int tid, const int & key);
+    bool contains(const int tid, const int & key);
+    template <class Visit>
+    void forEach(const int tid, Visit visit);
+    template <class T, class Map, class Combine>
+    T reduce(const int tid, const T & identity, Map map, Combine combine);
+    int64_t getSumOfKeys();
+    void printDebuggingDetails();
+
+private:
+    // a step of the search for a cuckoo path: key, in slot slot of the bucket of step parent, can move to bucket
+    struct pathStep {
+        int bucket;
+        int parent;                     // -1 for the two buckets of the new key
+        int slot;
+        int key;
+    };
+
+    // the second bucket is picked with a rehash of the key's hash, since the indexing policies use (some of) its bits for the first one
+    static uint32_t rehash(uint32_t h) {
+        h ^= h >> 16;
+        h *= 0x7feb352du;
+        h ^= h >> 15;
+        h *= 0x846ca68bu;
+        return h ^ (h >> 16);
+    }
+    void bucketsOf(const int key, int & b1, int & b2) {
+        const uint32_t h = hasher(key);
+        b1 = Index::home(h, numBuckets);
+        b2 = Index::home(rehash(h), numBuckets);
+        if(b2 == b1)
+            b2 = Index::next(b1, numBuckets);
+    }
+    int alternateOf(const int key, const int b) {
+        int b1, b2;
+        bucketsOf(key, b1, b2);
+        return (b == b1) ? b2 : b1;
+    }
+    // returns the slot of bucket b that holds key, or -1
+    int find(const int b, const int key) {
+        for(int i = 0; i < BUCKET_SLOTS; i++)
+            if(data[b].keys[i].load(memory_order_relaxed) == key)
+                return i;
+        return -1;
+    }
+    void lockPair(const int b1, const int b2) {
+        data[min(b1, b2)].lock.lock();
+        data[max(b1, b2)].lock.lock();
+    }
+    void unlockPair(const int b1, const int b2) {
+        data[b1].lock.unlock();
+        data[b2].lock.unlock();
+    }
+    int searchPath(const int b1, const int b2, pathStep * steps, int & freeSlot);
+    bool movePath(const pathStep * steps, int last, int freeSlot);
+};
+
+/**
+ * constructor: initialize the hash table's internals
+ *
+ * @param _numThreads maximum number of threads that will ever use the hash table (i.e., at least tid+1, where tid is the largest thread ID passed to any function of this class)
+ * @param _capacity is the INITIAL size of the hash table (maximum number of elements it can contain WITHOUT expansion)
+ */
+template <class Hash, class Index>
+AlgorithmK<Hash, Index>::AlgorithmK(const int _numThreads, const int _capacity)
+: numThreads(_numThreads), numBuckets(Index::roundCapacity(max(2, (_capacity + BUCKET_SLOTS - 1) / BUCKET_SLOTS))), stats(NULL) {
+    static_assert(sizeof(bucket) == 64, "a bucket must fill exactly one cache line");
+    capacity = numBuckets * BUCKET_SLOTS;
+    data = new bucket[numBuckets];
+    for(int i = 0; i < numBuckets; i++)
+        for(int j = 0; j < BUCKET_SLOTS; j++)
+            data[i].keys[j].store(NULL_VALUE, memory_order_relaxed);
+    STATS stats = new hashStats();
+}
+
+// destructor: clean up any allocated memory, etc.
+template <class Hash, class Index>
+AlgorithmK<Hash, Index>::~AlgorithmK() {
+    delete[] data;
+    delete stats;
+}
+
+/**
+ * breadth-first search for a cuckoo path from b1 or b2 to a bucket with an EMPTY slot, reading keys without locks (movePath() checks them again).
+ * returns the index in steps of the step whose bucket has EMPTY slot freeSlot, or -1 if none of the first MAX_SEARCH buckets has one
+ */
+template <class Hash, class Index>
+int AlgorithmK<Hash, Index>::searchPath(const int b1, const int b2, pathStep * steps, int & freeSlot) {
+    int size = 0;
+    steps[size++] = { b1, -1, -1, NULL_VALUE };
+    steps[size++] = { b2, -1, -1, NULL_VALUE };
+    for(int s = 0; s < size; s++) {
+        const int b = steps[s].bucket;
+        if((freeSlot = find(b, NULL_VALUE)) != -1)
+            return s;
+        for(int i = 0; i < BUCKET_SLOTS && size < MAX_SEARCH; i++) {
+            const int key = data[b].keys[i].load(memory_order_relaxed);
+            if(key != NULL_VALUE)
+                steps[size++] = { alternateOf(key, b), s, i, key };
+        }
+    }
+    return -1;
+}
+
+// moves the keys of the path that ends at step last one bucket along, starting from the end (slot freeSlot of its bucket). returns false if the path changed since it was found
+template <class Hash, class Index>
+bool AlgorithmK<Hash, Index>::movePath(const pathStep * steps, int last, int freeSlot) {
+    for(int s = last; steps[s].parent != -1; s = steps[s].parent) {
+        const int from = steps[steps[s].parent].bucket;
+        const int to = steps[s].bucket;
+        lockPair(from, to);
+        const bool unchanged = data[from].keys[steps[s].slot].load(memory_order_relaxed) == steps[s].key
+                            && data[to].keys[freeSlot].load(memory_order_relaxed) == NULL_VALUE;
+        if(unchanged) {
+            data[to].keys[freeSlot].store(steps[s].key, memory_order_relaxed);
+            data[from].keys[steps[s].slot].store(NULL_VALUE, memory_order_relaxed);
+        }
+        unlockPair(from, to);
+        if(!unchanged)
+            return false;
+        freeSlot = steps[s].slot;
+    }
+    return true;
+}
+
+// semantics: try to insert key. return true if successful (if key doesn't already exist), and false otherwise
+template <class Hash, class Index>
+bool AlgorithmK<Hash, Index>::insertIfAbsent(const int tid, const int & key) {
+    int b1, b2;
+    bucketsOf(key, b1, b2);
+    int moved = 0;
+    while(true) {
+        lockPair(b1, b2);
+        if(find(b1, key) != -1 || find(b2, key) != -1) {
+            unlockPair(b1, b2);
+            STATS stats->recordProbe(tid, 2 + moved);
+            return false;
+        }
+        for(const int b : { b1, b2 }) {
+            const int slot = find(b, NULL_VALUE);
+            if(slot != -1) {
+                data[b].keys[slot].store(key, memory_order_relaxed);
+                unlockPair(b1, b2);
+                STATS stats->recordProbe(tid, 2 + moved);
+                return true;
+            }
+        }
+        unlockPair(b1, b2);
+
+        // both buckets are full: make room by moving keys along a cuckoo path, and try again
+        pathStep steps[MAX_SEARCH];
+        int freeSlot;
+        const int last = searchPath(b1, b2, steps, freeSlot);
+        if(last == -1) {
+            STATS stats->recordProbe(tid, 2 + moved);
+            return false;
+        }
+        if(movePath(steps, last, freeSlot)) {
+            for(int s = last; steps[s].parent != -1; s = steps[s].parent)
+                moved++;
+        } else {
+            STATS stats->casFailures.inc(tid);
+        }
+    }
+}
+
+// semantics: try to erase key. return true if successful, and false otherwise
+template <class Hash, class Index>
+bool AlgorithmK<Hash, Index>::erase(const int tid, const int & key) {
+    int b1, b2;
+    bucketsOf(key, b1, b2);
+    lockPair(b1, b2);
+    bool result = false;
+    for(const int b : { b1, b2 }) {
+        const int slot = find(b, key);
+        if(slot != -1) {
+            data[b].keys[slot].store(NULL_VALUE, memory_order_relaxed);
+            result = true;
+            break;
+        }
+    }
+    unlockPair(b1, b2);
+    STATS stats->recordProbe(tid, 2);
+    return result;
+}
+
+// semantics: return true if key is in the set, and false otherwise (read-only: validated against the seqLocks of the key's two buckets, and retried if a writer changed either)
+template <class Hash, class Index>
+bool AlgorithmK<Hash, Index>::contains(const int tid, const int & key) {
+    int b1, b2;
+    bucketsOf(key, b1, b2);
+    while(true) {
+        const uint32_t s1 = data[b1].lock.readBegin();
+        const uint32_t s2 = data[b2].lock.readBegin();
+        const bool result = find(b1, key) != -1 || find(b2, key) != -1;
+        if(data[b1].lock.readValidate(s1) && data[b2].lock.readValidate(s2)) {
+            STATS stats->recordProbe(tid, 2);
+            return result;
+        }
+    }
+}
+
+/**
+ * semantics: call visit(key) for every key in the set, from several OpenMP threads at once. weakly consistent, and never blocks operations:
+ * every bucket is read at one moment in time, so a key that is in the set for the whole call is visited exactly once, unless an insert moves it to its other bucket
+ * during the call (then it may be visited twice, or not at all). a key that is inserted or erased meanwhile may or may not be visited
+ */
+template <class Hash, class Index>
+template <class Visit>
+void AlgorithmK<Hash, Index>::forEach(const int tid, Visit visit) {
+    parallelFor(numBuckets, [&](const int b) {
+        int keys[BUCKET_SLOTS];
+        uint32_t s;
+        do {
+            s = data[b].lock.readBegin();
+            for(int i = 0; i < BUCKET_SLOTS; i++)
+                keys[i] = data[b].keys[i].load(memory_order_relaxed);
+        } while(!data[b].lock.readValidate(s));
+        for(const int key : keys)
+            if(key != NULL_VALUE)
+                visit(key);
+    });
+}
+
+// semantics: combine the results of map(key) for every key in the set, starting from identity and in no particular order (so combine must be associative and commutative). scans like forEach()
+template <class Hash, class Index>
+template <class T, class Map, class Combine>
+T AlgorithmK<Hash, Index>::reduce(const int tid, const T & identity, Map map, Combine combine) {
+    return parallelReduce(numBuckets, identity, [&](T & partial, const int b) {
+        int keys[BUCKET_SLOTS];
+        uint32_t s;
+        do {
+            s = data[b].lock.readBegin();
+            for(int i = 0; i < BUCKET_SLOTS; i++)
+                keys[i] = data[b].keys[i].load(memory_order_relaxed);
+        } while(!data[b].lock.readValidate(s));
+        for(const int key : keys)
+            if(key != NULL_VALUE)
+                partial = combine(partial, map(key));
+    }, combine);
+}
+
+// semantics: return the sum of all KEYS in the set
+template <class Hash, class Index>
+int64_t AlgorithmK<Hash, Index>::getSumOfKeys() {
+    return reduce(0, (int64_t) 0, [](const int & key) { return (int64_t) key; }, [](const int64_t a, const int64_t b) { return a + b; });
+}
+
+// print any debugging details you want at the end of a trial in this function
+template <class Hash, class Index>
+void AlgorithmK<Hash, Index>::printDebuggingDetails() {
+    STATS {
+        long long live = 0;
+        for(int i = 0; i < numBuckets; i++)
+            for(int j = 0; j < BUCKET_SLOTS; j++)
+                if(data[i].keys[j] != NULL_VALUE)
+                    live++;
+        hashStats::printSlotCounts("table", live, 0, capacity - live);
+        stats->print(numThreads);
+    }
+}
@@ -0,0 +1,322 @@
+#pragma once
+#include "util.h"
+#include <atomic>
+#include <vector>
+using namespace std;
+
+/**
+ * non-expandable hash table with Robin Hood linear probing. an insert that meets a key closer to its home slot than the new key is to its own
+ * gives the new key that slot and moves the rest of the run one slot along, so the keys of every run of occupied slots stay sorted by home slot. hence
+ *   - a lookup stops at the first key whose home is after the home of the key it is looking for, instead of at the next EMPTY slot, which keeps misses short at high load factors, and
+ *   - erase shifts the following keys of the run one slot back (backward shift deletion), so there are no tombstones to lengthen later probes.
+ * probes never wrap around: there are OVERFLOW_SLOTS slots after the last home slot, and an insert that would need a slot past them fails (returns false, as if
+ * key were present). so the table holds at most capacity + OVERFLOW_SLOTS keys, and fewer if the keys homed near the end of the table run past the overflow slots.
+ * such inserts are counted in overflowedInserts, and printDebuggingDetails() reports them.
+ *
+ * slots are grouped into segments of SEGMENT_SIZE, each with a seqLock. insert and erase lock the segments they read or move keys in, in increasing order
+ * (which can't deadlock, since probes don't wrap), and contains() doesn't lock at all: it rereads its probe if a writer changed one of the segments it read.
+ */
+template <class Hash = Murmur3Finalizer, class Index = FastRangeIndexing>
+class AlgorithmR {
+public:
+    static constexpr int NULL_VALUE = -2;          // every other int is a valid key
+    static constexpr int SEGMENT_SIZE = 64;        // slots per seqLock (four cache lines)
+    static constexpr int OVERFLOW_SLOTS = 1024;
+    static constexpr int MAX_READ_SEGMENTS = 16;   // contains() locks its probe instead of validating it if it spans more segments than this
+
+    char padding0[PADDING_BYTES];
+    const int numThreads;
+    int capacity;                       // number of home slots
+    int numSlots;                       // capacity + OVERFLOW_SLOTS
+    int numSegments;
+    Hash hasher;
+    hashStats * stats;                  // NULL unless built with STATS
+    char padding2[PADDING_BYTES];
+    atomic<long long> overflowedInserts; // inserts that failed because their run would have passed the last overflow slot
+    char padding3[PADDING_BYTES];
+
+    struct alignas(PADDING_BYTES) segment {
+        seqLock lock;
+    };
+
+    atomic<int> * data;
+    segment * segments;
+
+    AlgorithmR(const int _numThreads, const int _capacity);
+    ~AlgorithmR();
+    bool insertIfAbsent(const int tid, const int & key);
+    bool erase(const int tid, const int & key);
+    bool contains(const int tid, const int & key);
+    template <class Visit>
+    void forEach(const int tid, Visit visit);
+    template <class T, class Map, class Combine>
+    T reduce(const int tid, const T & identity, Map map, Combine combine);
+    int64_t getSumOfKeys();
+    void printDebuggingDetails();
+
+private:
+    int homeOf(const int key) { return Index::home(hasher(key), capacity); }
+    // acquires the locks of segments (last, segmentOf(index)], so a writer holding [first, last] also holds the segment of slot index
+    void lockThrough(const int index, int & last) {
+        while(last < index / SEGMENT_SIZE)
+            segments[++last].lock.lock();
+    }
+    void unlockRange(const int first, const int last) {
+        for(int s = first; s <= last; s++)
+            segments[s].lock.unlock();
+    }
+    bool containsLocked(const int tid, const int & key);
+    // appends the keys whose home slot is in segment s to keys, as of one moment in time
+    void collectSegment(const int s, vector<int> & keys);
+};
+
+/**
+ * constructor: initialize the hash table's internals
+ *
+ * @param _numThreads maximum number of threads that will ever use the hash table (i.e., at least tid+1, where tid is the largest thread ID passed to any function of this class)
+ * @param _capacity is the INITIAL size of the hash table (maximum number of elements it can contain WITHOUT expansion)
+ */
+template <class Hash, class Index>
+AlgorithmR<Hash, Index>::AlgorithmR(const int _numThreads, const int _capacity)
+: numThreads(_numThreads), capacity(Index::roundCapacity(_capacity)), stats(NULL), overflowedInserts(0) {
+    numSlots = capacity + OVERFLOW_SLOTS;
+    numSegments = (numSlots + SEGMENT_SIZE - 1) / SEGMENT_SIZE;
+    data = new atomic<int>[numSlots];
+    for(int i = 0; i < numSlots; i++)
+        data[i].store(NULL_VALUE, memory_order_relaxed);
+    segments = new segment[numSegments];
+    STATS stats = new hashStats();
+}
+
+// destructor: clean up any allocated memory, etc.
+template <class Hash, class Index>
+AlgorithmR<Hash, Index>::~AlgorithmR() {
+    delete[] data;
+    delete[] segments;
+    delete stats;
+}
+
+// semantics: try to insert key. return true if successful (if key doesn't already exist), and false otherwise
+template <class Hash, class Index>
+bool AlgorithmR<Hash, Index>::insertIfAbsent(const int tid, const int & key) {
+    const int home = homeOf(key);
+    const int first = home / SEGMENT_SIZE;
+    int last = first;
+    segments[first].lock.lock();
+
+    // find key, or the first slot whose key has a later home than key (or is EMPTY): key belongs there
+    int index = home;
+    for(; index < numSlots; index++) {
+        lockThrough(index, last);
+        const int found = data[index].load(memory_order_relaxed);
+        if(found == key) {
+            STATS stats->recordProbe(tid, index - home + 1);
+            unlockRange(first, last);
+            return false;
+        }
+        if(found == NULL_VALUE || homeOf(found) > home)
+            break;
+    }
+    STATS stats->recordProbe(tid, index - home + 1);
+
+    // the keys from there up to the next EMPTY slot move one slot along
+    int empty = index;
+    for(; empty < numSlots; empty++) {
+        lockThrough(empty, last);
+        if(data[empty].load(memory_order_relaxed) == NULL_VALUE)
+            break;
+    }
+    if(empty == numSlots) {
+        unlockRange(first, last);
+        overflowedInserts.fetch_add(1, memory_order_relaxed);
+        return false;
+    }
+    for(int i = empty; i > index; i--)
+        data[i].store(data[i - 1].load(memory_order_relaxed), memory_order_relaxed);
+    data[index].store(key, memory_order_relaxed);
+    unlockRange(first, last);
+    return true;
+}
+
+// semantics: try to erase key. return true if successful, and false otherwise
+template <class Hash, class Index>
+bool AlgorithmR<Hash, Index>::erase(const int tid, const int & key) {
+    const int home = homeOf(key);
+    const int first = home / SEGMENT_SIZE;
+    int last = first;
+    segments[first].lock.lock();
+
+    int index = home;
+    for(; index < numSlots; index++) {
+        lockThrough(index, last);
+        const int found = data[index].load(memory_order_relaxed);
+        if(found == key)
+            break;
+        if(found == NULL_VALUE || homeOf(found) > home) {
+            STATS stats->recordProbe(tid, index - home + 1);
+            unlockRange(first, last);
+            return false;
+        }
+    }
+    STATS stats->recordProbe(tid, index - home + 1);
+    if(index == numSlots) {
+        unlockRange(first, last);
+        return false;
+    }
+
+    // backward shift: every following key of the run that isn't in its home slot moves one slot back
+    for(; index + 1 < numSlots; index++) {
+        lockThrough(index + 1, last);
+        const int next = data[index + 1].load(memory_order_relaxed);
+        if(next == NULL_VALUE || homeOf(next) == index + 1)
+            break;
+        data[index].store(next, memory_order_relaxed);
+    }
+    data[index].store(NULL_VALUE, memory_order_relaxed);
+    unlockRange(first, last);
+    return true;
+}
+
+// semantics: return true if key is in the set, and false otherwise (read-only: validated against the seqLocks of the segments read, and retried if a writer changed one of them)
+template <class Hash, class Index>
+bool AlgorithmR<Hash, Index>::contains(const int tid, const int & key) {
+    const int home = homeOf(key);
+    uint32_t seqs[MAX_READ_SEGMENTS];
+    while(true) {
+        const int first = home / SEGMENT_SIZE;
+        int last = first - 1;
+        bool result = false;
+        int index = home;
+        for(; index < numSlots; index++) {
+            if(last < index / SEGMENT_SIZE) {
+                if(++last - first == MAX_READ_SEGMENTS)
+                    return containsLocked(tid, key);
+                seqs[last - first] = segments[last].lock.readBegin();
+            }
+            const int found = data[index].load(memory_order_relaxed);
+            if(found == key) {
+                result = true;
+                break;
+            }
+            if(found == NULL_VALUE || homeOf(found) > home)
+                break;
+        }
+        bool valid = true;
+        for(int s = first; s <= last && valid; s++)
+            valid = segments[s].lock.readValidate(seqs[s - first]);
+        if(valid) {
+            STATS stats->recordProbe(tid, index - home + 1);
+            return result;
+        }
+    }
+}
+
+// contains() for probes that span more than MAX_READ_SEGMENTS segments: holds their locks instead
+template <class Hash, class Index>
+bool AlgorithmR<Hash, Index>::containsLocked(const int tid, const int & key) {
+    const int home = homeOf(key);
+    const int first = home / SEGMENT_SIZE;
+    int last = first;
+    segments[first].lock.lock();
+    bool result = false;
+    int index = home;
+    for(; index < numSlots; index++) {
+        lockThrough(index, last);
+        const int found = data[index].load(memory_order_relaxed);
+        if(found == key) {
+            result = true;
+            break;
+        }
+        if(found == NULL_VALUE || homeOf(found) > home)
+            break;
+    }
+    STATS stats->recordProbe(tid, index - home + 1);
+    unlockRange(first, last);
+    return result;
+}
+
+// the keys homed in segment s are in the runs that start in it, and since runs are sorted by home, they end at the first key (past the segment) homed after it
+template <class Hash, class Index>
+void AlgorithmR<Hash, Index>::collectSegment(const int s, vector<int> & keys) {
+    const int begin = s * SEGMENT_SIZE;
+    const int end = begin + SEGMENT_SIZE;
+    const size_t size = keys.size();
+    vector<uint32_t> seqs;
+    while(true) {
+        keys.resize(size);
+        seqs.clear();
+        for(int index = begin; index < numSlots; index++) {
+            if(index % SEGMENT_SIZE == 0)
+                seqs.push_back(segments[index / SEGMENT_SIZE].lock.readBegin());
+            const int found = data[index].load(memory_order_relaxed);
+            if(found == NULL_VALUE) {
+                if(index >= end) break;
+                continue;
+            }
+            const int h = homeOf(found);
+            if(h >= end) break;
+            if(h >= begin) keys.push_back(found);
+        }
+        bool valid = true;
+        for(size_t i = 0; i < seqs.size() && valid; i++)
+            valid = segments[s + i].lock.readValidate(seqs[i]);
+        if(valid)
+            return;
+    }
+}
+
+/**
+ * semantics: call visit(key) for every key in the set, from several OpenMP threads at once. weakly consistent, and never blocks operations:
+ * the keys homed in each segment are read at one moment in time (but different segments at different moments), so a key that is in the set for the whole call is visited exactly once,
+ * and one that is inserted or erased meanwhile may or may not be
+ */
+template <class Hash, class Index>
+template <class Visit>
+void AlgorithmR<Hash, Index>::forEach(const int tid, Visit visit) {
+    parallelFor(numSegments, [&](const int s) {
+        vector<int> keys;
+        collectSegment(s, keys);
+        for(const int key : keys)
+            visit(key);
+    });
+}
+
+// semantics: combine the results of map(key) for every key in the set, starting from identity and in no particular order (so combine must be associative and commutative). scans like forEach()
+template <class Hash, class Index>
+template <class T, class Map, class Combine>
+T AlgorithmR<Hash, Index>::reduce(const int tid, const T & identity, Map map, Combine combine) {
+    return parallelReduce(numSegments, identity, [&](T & partial, const int s) {
+        vector<int> keys;
+        collectSegment(s, keys);
+        for(const int key : keys)
+            partial = combine(partial, map(key));
+    }, combine);
+}
+
+// semantics: return the sum of all KEYS in the set
+template <class Hash, class Index>
+int64_t AlgorithmR<Hash, Index>::getSumOfKeys() {
+    return reduce(0, (int64_t) 0, [](const int & key) { return (int64_t) key; }, [](const int64_t a, const int64_t b) { return a + b; });
+}
+
+// print any debugging details you want at the end of a trial in this function
+template <class Hash, class Index>
+void AlgorithmR<Hash, Index>::printDebuggingDetails() {
+    if(overflowedInserts > 0)
+        cout<<"WARNING: "<<overflowedInserts<<" inserts failed because the table was full (their runs would have passed the last of the OVERFLOW_SLOTS="<<OVERFLOW_SLOTS<<" slots)"<<endl;
+    STATS {
+        long long live = 0, totalDisplacement = 0;
+        int maxDisplacement = 0;
+        for(int i = 0; i < numSlots; i++) {
+            int key = data[i];
+            if(key == NULL_VALUE) continue;
+            live++;
+            const int displacement = i - homeOf(key);
+            totalDisplacement += displacement;
+            maxDisplacement = max(maxDisplacement, displacement);
+        }
+        hashStats::printSlotCounts("table", live, 0, numSlots - live);
+        cout<<"displacement: mean "<<(live ? (double) totalDisplacement / live : 0.)<<", max "<<maxDisplacement<<endl;
+        stats->print(numThreads);
+    }
+}
@@ -9,15 +9,42 @@
 #include <cstring>
 #include <iostream>
 #include <time.h>
+#include <chrono>
 
 #include "util.h"
 #include "alg_a.h"
 #include "alg_b.h"
 #include "alg_c.h"
 #include "alg_d.h"
+#include "alg_d_map.h"
+#include "alg_e.h"
+#include "alg_k.h"
+#include "alg_r.h"
+#include "workload.h"
 
 using namespace std;
 
+// how benchmark threads are placed on CPUs (-pin)
+enum pinning_t { PIN_NONE, PIN_COMPACT, PIN_SCATTER };
+
+// one thread's latency measurements (-lat): a histogram per operation type, and the number of spikes and the slowest operation in every 1s interval of the run.
+// only its owner thread writes it, so recording is a few plain increments
+struct latencyRecorder {
+    latencyHistogram histograms[NUM_OP_TYPES];
+    int numIntervals;
+    long long * intervalSpikes;
+    uint64_t * intervalMax;
+
+    latencyRecorder(int _numIntervals) : numIntervals(_numIntervals) {
+        intervalSpikes = new long long[numIntervals]();
+        intervalMax = new uint64_t[numIntervals]();
+    }
+    ~latencyRecorder() {
+        delete[] intervalSpikes;
+        delete[] intervalMax;
+    }
+};
+
 template <class DataStructureType>
 struct globals_t {
     PaddedRandom rngs[MAX_THREADS];
@@ -32,6 +59,7 @@ struct globals_t {
     volatile char padding4[PADDING_BYTES];
     atomic_int running;         // used for a custom barrier implementation (how many threads are waiting?)
     volatile char padding5[PADDING_BYTES];
+    atomic_int streamWraps;     // how many times threads ran out of precomputed operations and replayed them from the start (see fillStream)
     DataStructureType * ds;
     debugCounter numTotalOps;   // already has padding built in at the beginning and end
     debugCounter keyChecksum;
@@ -39,9 +67,15 @@ struct globals_t {
     int totalThreads;
     int keyRangeSize;
     int tableSize;
+    workload * w;               // the keys and operations that threads perform (-d, -r)
+    int batchSize;
+    int spikeMicros;            // if > 0, time every operation, and count operations slower than this as spikes (-lat)
+    pinning_t pinning;
+    chrono::steady_clock::time_point latencyStart;
+    latencyRecorder * latencies[MAX_THREADS];
     volatile char padding7[PADDING_BYTES];
     
-    globals_t(int _millisToRun, int _totalThreads, int _keyRangeSize, int _tableSize, DataStructureType * _ds) {
+    globals_t(int _millisToRun, int _totalThreads, int _keyRangeSize, int _tableSize, workload * _w, int _batchSize, int _spikeMicros, pinning_t _pinning, DataStructureType * _ds) {
         for (int i=0;i<MAX_THREADS;++i) {
             rngs[i].setSeed(i+1); // +1 because we don't want thread 0 to get a seed of 0, since seeds of 0 usually mean all random numbers are zero...
         }
@@ -49,28 +83,138 @@ struct globals_t {
         done = false;
         start = false;
         running = 0;
+        streamWraps = 0;
         ds = _ds;
         millisToRun = _millisToRun;
         totalThreads = _totalThreads;
         keyRangeSize = _keyRangeSize;
         tableSize = _tableSize;
+        w = _w;
+        batchSize = _batchSize;
+        spikeMicros = _spikeMicros;
+        pinning = _pinning;
+        for (int i=0;i<MAX_THREADS;++i) {
+            // the last interval catches operations that finish after millisToRun, while threads notice that they are done
+            latencies[i] = (spikeMicros > 0 && i < totalThreads) ? new latencyRecorder(millisToRun / 1000 + 2) : NULL;
+        }
     }
     ~globals_t() {
+        for (int i=0;i<MAX_THREADS;++i) {
+            delete latencies[i];
+        }
         delete ds;
     }
 } __attribute__((aligned(PADDING_BYTES)));
 
+// detects data structures that offer insertBatch, eraseBatch and containsBatch (see AlgorithmC)
+template <class T, class = void>
+struct hasBatchOps : false_type {};
+template <class T>
+struct hasBatchOps<T, void_t<decltype(&T::insertBatch), decltype(&T::eraseBatch), decltype(&T::containsBatch)>> : true_type {};
+
+// record the latency of an operation of type op that thread tid started at time opStart (-lat)
+void recordLatency(auto g, const int tid, const int op, const chrono::steady_clock::time_point opStart) {
+    auto opEnd = chrono::steady_clock::now();
+    uint64_t nanos = chrono::duration_cast<chrono::nanoseconds>(opEnd - opStart).count();
+    auto rec = g->latencies[tid];
+    rec->histograms[op].record(nanos);
+    int interval = min((int) chrono::duration_cast<chrono::seconds>(opEnd - g->latencyStart).count(), rec->numIntervals - 1);
+    if (nanos > (uint64_t) g->spikeMicros * 1000) ++rec->intervalSpikes[interval];
+    if (nanos > rec->intervalMax[interval]) rec->intervalMax[interval] = nanos;
+}
+
+// merge the latencies recorded by all threads, and print percentiles per operation type and spikes per 1s interval (-lat)
+void printLatencies(auto g) {
+    auto merged = new latencyRecorder(g->latencies[0]->numIntervals);
+    for (int tid=0;tid<g->totalThreads;++tid) {
+        auto rec = g->latencies[tid];
+        for (int op=0;op<NUM_OP_TYPES;++op) {
+            merged->histograms[op].merge(rec->histograms[op]);
+        }
+        for (int i=0;i<merged->numIntervals;++i) {
+            merged->intervalSpikes[i] += rec->intervalSpikes[i];
+            merged->intervalMax[i] = max(merged->intervalMax[i], rec->intervalMax[i]);
+        }
+    }
+    
+    cout<<"latency (ns)   count            p50        p99        p99.9      max"<<endl;
+    for (int op=0;op<NUM_OP_TYPES;++op) {
+        auto & h = merged->histograms[op];
+        if (h.getCount() == 0) continue;
+        printf("%-14s %-16llu %-10llu %-10llu %-10llu %llu\n", OP_NAMES[op], (unsigned long long) h.getCount(),
+                (unsigned long long) h.getPercentile(50), (unsigned long long) h.getPercentile(99),
+                (unsigned long long) h.getPercentile(99.9), (unsigned long long) h.getMax());
+    }
+    cout<<"latency spikes (operations slower than "<<g->spikeMicros<<"us) per 1s interval:"<<endl;
+    for (int i=0;i<merged->numIntervals;++i) {
+        if (merged->intervalMax[i] == 0) continue; // no operation finished in this interval
+        cout<<"    "<<i<<"s-"<<(i+1)<<"s: "<<merged->intervalSpikes[i]<<" spikes, slowest operation "<<(merged->intervalMax[i] / 1000.)<<"us"<<endl;
+    }
+    cout<<endl;
+    delete merged;
+}
+
 void printUpdatedThroughput(auto g, int64_t elapsedNow) {
     auto opsNow = g->numTotalOps.getTotal();
     cout<<elapsedNow <<"ms: "<<opsNow<<" total_ops"<<endl;
     cout<<elapsedNow <<"ms: "<<(opsNow * 1000 / elapsedNow)<<" throughput"<<endl;
 }
 
+// one trial of a sweep (-sweep): the resize policy it ran with, and its throughput and table memory
+struct sweepPoint {
+    resizePolicy resize;
+    long long throughput;
+    size_t peakBytes;
+    size_t endBytes;
+};
+vector<sweepPoint> sweepPoints; // appended to by every trial of an algorithm with a resize policy
+
+bool isDefault(const resizePolicy & resize) {
+    const resizePolicy defaults;
+    return resize.maxLoadFactor == defaults.maxLoadFactor && resize.growthFactor == defaults.growthFactor && resize.minCapacity == defaults.minCapacity;
+}
+
 template <class DataStructureType>
-void runExperiment(int keyRangeSize, int tableSize, int millisToRun, int totalThreads) {
+void runExperiment(int keyRangeSize, int tableSize, int millisToRun, int totalThreads, workload * w, int batchSize, int migrationStep, int spikeMicros, memoryPolicy memory, resizePolicy resize, pinning_t pinning) {
+    if (batchSize > 1 && !hasBatchOps<DataStructureType>::value) {
+        cout<<"ERROR: this algorithm has no batched operations (-b)"<<endl;
+        exit(1);
+    }
+    
+    if (migrationStep > 0 && !is_constructible<DataStructureType, int, int, int>::value) {
+        cout<<"ERROR: this algorithm has no incremental resizing (-inc)"<<endl;
+        exit(1);
+    }
+    
+    if ((memory.placement != NUMA_FIRST_TOUCH || memory.pages != HUGE_PAGES_OFF) && !is_constructible<DataStructureType, int, int, int, memoryPolicy>::value) {
+        cout<<"ERROR: this algorithm has no NUMA placement or huge pages (-numa, -hp)"<<endl;
+        exit(1);
+    }
+    
+    constexpr bool resizable = is_constructible<DataStructureType, int, int, int, memoryPolicy, resizePolicy>::value;
+    if (!isDefault(resize) && !resizable) {
+        cout<<"ERROR: this algorithm has no resize policy (-maxload, -grow, -mincap, -sweep)"<<endl;
+        exit(1);
+    }
+    
     // create globals struct that all threads will access (with padding to prevent false sharing on control logic meta data)
-    auto dataStructure = new DataStructureType(totalThreads, tableSize);
-    auto g = new globals_t<DataStructureType>(millisToRun, totalThreads, keyRangeSize, tableSize, dataStructure);
+    DataStructureType * dataStructure;
+    if constexpr (resizable) {
+        dataStructure = new DataStructureType(totalThreads, tableSize, migrationStep, memory, resize);
+    } else if constexpr (is_constructible<DataStructureType, int, int, int, memoryPolicy>::value) {
+        dataStructure = new DataStructureType(totalThreads, tableSize, migrationStep, memory);
+    } else if constexpr (is_constructible<DataStructureType, int, int, int>::value) {
+        dataStructure = new DataStructureType(totalThreads, tableSize, migrationStep);
+    } else {
+        dataStructure = new DataStructureType(totalThreads, tableSize);
+    }
+    auto g = new globals_t<DataStructureType>(millisToRun, totalThreads, keyRangeSize, tableSize, w, batchSize, spikeMicros, pinning, dataStructure);
+    
+    // prefill the set (-lf) from the main thread, as thread 0, before the benchmark threads start
+    PaddedRandom prefillRng(MAX_THREADS+1);
+    w->prefill(prefillRng, [&](const int key) {
+        if (dataStructure->insertIfAbsent(0, key)) g->keyChecksum.add(0, key);
+    });
     
     /**
      * 
@@ -83,6 +227,14 @@ void runExperiment(int keyRangeSize, int tableSize, int millisToRun, int totalTh
     for (int tid=0;tid<g->totalThreads;++tid) {
         threads[tid] = new thread([&, tid]() { /* access all variables by reference, except tid, which we copy (since we don't want our tid to be a reference to the changing loop variable) */
                 const int OPS_BETWEEN_TIME_CHECKS = 500; // only check the current time (to see if we should stop) once every X operations, to amortize the overhead of time checking
+                if (g->pinning != PIN_NONE) {
+                    int cpu = numaTopology::get().cpuOf(tid, g->pinning == PIN_SCATTER);
+                    if (!numaTopology::pinTo(cpu)) TPRINT("could not pin to cpu "<<cpu);
+                }
+                keyStream stream;   // filled after pinning, so it is allocated on this thread's node
+                g->w->fillStream(tid, g->totalThreads, g->millisToRun, g->rngs[tid], stream); // before the barrier, so it isn't timed
+                int * batchKeys = new int[g->batchSize];
+                bool * batchResults = new bool[g->batchSize];
 
                 // BARRIER WAIT
                 g->running.fetch_add(1);
@@ -97,26 +249,56 @@ void runExperiment(int keyRangeSize, int tableSize, int millisToRun, int totalTh
 
                     VERBOSE if (cnt&&((cnt % 1000000) == 0)) TPRINT("op# "<<cnt);
                     
-                    // flip a coin to decide: insert or erase?
-                    // generate a random double in [0, 1]
-                    double operationType = g->rngs[tid].nextNatural() / (double) numeric_limits<unsigned int>::max();
-                    //cout<<"operationType="<<operationType<<endl;
+                    // take the next operation (lookup, insert or erase, and its key) from the precomputed stream
+                    int next = stream.advance();
+                    int op = stream.ops[next];
+                    chrono::steady_clock::time_point opStart;
                     
-                    // generate random key
-                    int key = 1 + (g->rngs[tid].nextNatural() % g->keyRangeSize);
+                    if constexpr (hasBatchOps<DataStructureType>::value) {
+                        if (g->batchSize > 1) {
+                            // take a batch of keys from the stream, and look up, insert or delete all of them (as the first one's operation says) with one call
+                            batchKeys[0] = stream.keys[next];
+                            for (int j=1;j<g->batchSize;++j) {
+                                batchKeys[j] = stream.keys[stream.advance()];
+                            }
+                            if (g->spikeMicros > 0) opStart = chrono::steady_clock::now();
+                            if (op == OP_CONTAINS) {
+                                g->ds->containsBatch(tid, batchKeys, batchResults, g->batchSize);
+                            } else if (op == OP_INSERT) {
+                                g->ds->insertBatch(tid, batchKeys, batchResults, g->batchSize);
+                            } else {
+                                g->ds->eraseBatch(tid, batchKeys, batchResults, g->batchSize);
+                            }
+                            if (g->spikeMicros > 0) recordLatency(g, tid, op, opStart); // a whole batch is one sample
+                            if (op != OP_CONTAINS) {
+                                for (int j=0;j<g->batchSize;++j) if (batchResults[j]) g->keyChecksum.add(tid, (op == OP_INSERT) ? batchKeys[j] : -batchKeys[j]);
+                            }
+                            g->numTotalOps.add(tid, g->batchSize);
+                            continue;
+                        }
+                    }
                     
-                    // insert or delete this key
-                    if (operationType < 0.5) {
-                        auto result = g->ds->insertIfAbsent(tid, key);
-                        if (result) g->keyChecksum.add(tid, key);
+                    int key = stream.keys[next];
+                    
+                    // look up, insert or delete this key
+                    if (g->spikeMicros > 0) opStart = chrono::steady_clock::now();
+                    bool result;
+                    if (op == OP_CONTAINS) {
+                        result = g->ds->contains(tid, key);
+                    } else if (op == OP_INSERT) {
+                        result = g->ds->insertIfAbsent(tid, key);
                     } else {
-                        auto result = g->ds->erase(tid, key);
-                        if (result) g->keyChecksum.add(tid, -key);
+                        result = g->ds->erase(tid, key);
                     }
+                    if (g->spikeMicros > 0) recordLatency(g, tid, op, opStart);
+                    if (result && op != OP_CONTAINS) g->keyChecksum.add(tid, (op == OP_INSERT) ? key : -key);
                     
                     g->numTotalOps.inc(tid);
                 }
                 
+                delete[] batchKeys;
+                delete[] batchResults;
+                if (stream.wraps) g->streamWraps.fetch_add(stream.wraps);
                 g->running.fetch_add(-1);
                 TPRINT("terminated");
         });
@@ -128,6 +310,7 @@ void runExperiment(int keyRangeSize, int tableSize, int millisToRun, int totalTh
     
     printf("main thread: starting timer...\n");
     g->timer.startTimer();
+    g->latencyStart = chrono::steady_clock::now();
     __asm__ __volatile__ ("" ::: "memory"); // prevent compiler from reordering "start = true;" before the timer start; this is mostly paranoia, since start is volatile, and nothing should be reordered around volatile reads/writes (by the *compiler*)
     
     g->start = true; // release all threads from the barrier, so they can work
@@ -195,21 +378,203 @@ void runExperiment(int keyRangeSize, int tableSize, int millisToRun, int totalTh
     cout<<endl;
     cout<<"total completed ops   : "<<numTotalOps<<endl;
     cout<<"throughput            : "<<(long long) (numTotalOps * 1000. / g->elapsedMillis)<<endl;
+    cout<<"nanoseconds per op    : "<<(g->elapsedMillis * 1000000. * g->totalThreads / numTotalOps)<<endl; // average latency of one operation as seen by one thread
     cout<<"elapsed milliseconds  : "<<g->elapsedMillis<<endl;
+    if (g->streamWraps > 0 && g->w->kind != workload::REPLAY) {
+        cout<<"NOTE: threads ran out of precomputed operations "<<g->streamWraps<<" times and replayed them from the start (see -d)"<<endl;
+    }
+    if constexpr (resizable) {
+        cout<<"table memory (MB)     : "<<(g->ds->tableBytes() / 1e6)<<" at the end, "<<(g->ds->peakTableBytes() / 1e6)<<" at the peak"<<endl;
+        sweepPoints.push_back({ resize, (long long) (numTotalOps * 1000. / g->elapsedMillis), g->ds->peakTableBytes(), g->ds->tableBytes() });
+    }
     cout<<endl;
     
+    if (g->spikeMicros > 0) {
+        printLatencies(g);
+    }
+    
     delete g;
 }
 
+// every combination of policies would multiply the instances of runExperiment, and the build time, many times over. so unless built with
+// USER_DEFINES="-DALL_POLICY_COMBINATIONS", every hash function is only built with the default indexing policy and vice versa (-H murmur3, -i fastrange),
+// except identity, which is built with pow2 instead (see identityIndexingBuilt), and bucket layouts other than padded (and A's and B's lock tables) only with both defaults
+#ifdef ALL_POLICY_COMBINATIONS
+constexpr bool ALL_COMBINATIONS_BUILT = true;
+#else
+constexpr bool ALL_COMBINATIONS_BUILT = false;
+#endif
+
+// fastrange takes the high bits of the hash, which identity leaves at 0 for keys below 2^32 / capacity (i.e., every key of the key range),
+// so that every key would probe from slot 0. identity is never run with fastrange, and is built with pow2 (the low bits) by default
+template <class Hash, class Index>
+constexpr bool identityIndexingBuilt() {
+    return !is_same<Hash, IdentityHash>::value || (!is_same<Index, FastRangeIndexing>::value && (ALL_COMBINATIONS_BUILT || is_same<Index, PowerOfTwoIndexing>::value));
+}
+
+template <class Hash, class Index>
+constexpr bool policiesBuilt() {
+    if constexpr (is_same<Hash, IdentityHash>::value) return identityIndexingBuilt<Hash, Index>();
+    return ALL_COMBINATIONS_BUILT || is_same<Hash, Murmur3Finalizer>::value || is_same<Index, FastRangeIndexing>::value;
+}
+
+template <class Hash, class Index>
+constexpr bool allLayoutsBuilt() {
+    return ALL_COMBINATIONS_BUILT || (is_same<Hash, Murmur3Finalizer>::value && is_same<Index, FastRangeIndexing>::value);
+}
+
+// run experiment for Table (one of the non-expandable tables A, B and C) with the given hash and indexing policies and the bucket layout named by layout.
+// returns false if layout is not a known layout name, or not built for these policies (see allLayoutsBuilt)
+template <template <class...> class Table, class Hash, class Index>
+bool runWithLayout(const char * layout, int keyRangeSize, int tableSize, int millisToRun, int totalThreads, workload * w, int batchSize, int migrationStep, int spikeMicros, memoryPolicy memory, resizePolicy resize, pinning_t pinning) {
+    if (!strcmp(layout, "padded")) {
+        runExperiment<Table<Hash, Index, PaddedLayout>>(keyRangeSize, tableSize, millisToRun, totalThreads, w, batchSize, migrationStep, spikeMicros, memory, resize, pinning);
+        return true;
+    }
+    if constexpr (allLayoutsBuilt<Hash, Index>()) {
+        if (!strcmp(layout, "packed")) {
+            runExperiment<Table<Hash, Index, PackedLayout>>(keyRangeSize, tableSize, millisToRun, totalThreads, w, batchSize, migrationStep, spikeMicros, memory, resize, pinning);
+        }
+        else if (!strcmp(layout, "striped")) {
+            runExperiment<Table<Hash, Index, StripedLayout>>(keyRangeSize, tableSize, millisToRun, totalThreads, w, batchSize, migrationStep, spikeMicros, memory, resize, pinning);
+        }
+        else {
+            cout<<"Bad bucket layout name: "<<layout<<endl;
+            return false;
+        }
+        return true;
+    } else {
+        cout<<"ERROR: bucket layout "<<layout<<" is only built with -H murmur3 -i fastrange (build with USER_DEFINES=\"-DALL_POLICY_COMBINATIONS\" for the others)"<<endl;
+        return false;
+    }
+}
+
+// run experiment for Table (one of the lock-based tables A and B) like runWithLayout, but also accepting the lock table layouts, whose names select the type of the striped locks.
+// returns false if layout is not a known layout name, or not built for these policies (see allLayoutsBuilt)
+template <template <class...> class Table, class Hash, class Index>
+bool runWithLockLayout(const char * layout, int keyRangeSize, int tableSize, int millisToRun, int totalThreads, workload * w, int batchSize, int migrationStep, int spikeMicros, memoryPolicy memory, resizePolicy resize, pinning_t pinning) {
+    if constexpr (allLayoutsBuilt<Hash, Index>()) {
+        if (!strcmp(layout, "locktable")) {
+            runExperiment<Table<Hash, Index, LockTableLayout<>, seqLock>>(keyRangeSize, tableSize, millisToRun, totalThreads, w, batchSize, migrationStep, spikeMicros, memory, resize, pinning);
+        }
+        else if (!strcmp(layout, "locktable-ttas")) {
+            runExperiment<Table<Hash, Index, LockTableLayout<>, ttasLock>>(keyRangeSize, tableSize, millisToRun, totalThreads, w, batchSize, migrationStep, spikeMicros, memory, resize, pinning);
+        }
+        else if (!strcmp(layout, "locktable-ticket")) {
+            runExperiment<Table<Hash, Index, LockTableLayout<>, ticketLock>>(keyRangeSize, tableSize, millisToRun, totalThreads, w, batchSize, migrationStep, spikeMicros, memory, resize, pinning);
+        }
+        else {
+            return runWithLayout<Table, Hash, Index>(layout, keyRangeSize, tableSize, millisToRun, totalThreads, w, batchSize, migrationStep, spikeMicros, memory, resize, pinning);
+        }
+        return true;
+    } else {
+        return runWithLayout<Table, Hash, Index>(layout, keyRangeSize, tableSize, millisToRun, totalThreads, w, batchSize, migrationStep, spikeMicros, memory, resize, pinning); // which rejects the lock tables too
+    }
+}
+
+// run experiment for the selected algorithm, using the given hash and indexing policies (and the bucket layout named by layout, where applicable).
+// returns false on a bad name
+template <class Hash, class Index>
+bool runAlgorithm(char * alg, const char * layout, int keyRangeSize, int tableSize, int millisToRun, int totalThreads, workload * w, int batchSize, int migrationStep, int spikeMicros, memoryPolicy memory, resizePolicy resize, pinning_t pinning) {
+    if (!strcmp(alg, "A")) {
+        return runWithLockLayout<AlgorithmA, Hash, Index>(layout, keyRangeSize, tableSize, millisToRun, totalThreads, w, batchSize, migrationStep, spikeMicros, memory, resize, pinning);
+    }
+	else if (!strcmp(alg, "B")) {
+         return runWithLockLayout<AlgorithmB, Hash, Index>(layout, keyRangeSize, tableSize, millisToRun, totalThreads, w, batchSize, migrationStep, spikeMicros, memory, resize, pinning);
+    }
+	else if (!strcmp(alg, "C")) {
+         return runWithLayout<AlgorithmC, Hash, Index>(layout, keyRangeSize, tableSize, millisToRun, totalThreads, w, batchSize, migrationStep, spikeMicros, memory, resize, pinning);
+    }
+	else if (!strcmp(alg, "D")) {
+         runExperiment<AlgorithmD<KeySlot, Hash, Index>>(keyRangeSize, tableSize, millisToRun, totalThreads, w, batchSize, migrationStep, spikeMicros, memory, resize, pinning);
+    }
+	else if (!strcmp(alg, "DM")) {
+         runExperiment<AlgorithmDMap<Hash, Index>>(keyRangeSize, tableSize, millisToRun, totalThreads, w, batchSize, migrationStep, spikeMicros, memory, resize, pinning);
+    }
+	else if (!strcmp(alg, "E")) {
+         runExperiment<AlgorithmE<Hash, Index>>(keyRangeSize, tableSize, millisToRun, totalThreads, w, batchSize, migrationStep, spikeMicros, memory, resize, pinning);
+    }
+	else if (!strcmp(alg, "K")) {
+         runExperiment<AlgorithmK<Hash, Index>>(keyRangeSize, tableSize, millisToRun, totalThreads, w, batchSize, migrationStep, spikeMicros, memory, resize, pinning);
+    }
+	else if (!strcmp(alg, "R")) {
+         runExperiment<AlgorithmR<Hash, Index>>(keyRangeSize, tableSize, millisToRun, totalThreads, w, batchSize, migrationStep, spikeMicros, memory, resize, pinning);
+    }
+ 	else {
+        cout<<"Bad algorithm name: "<<alg<<endl;
+        return false;
+    }
+    return true;
+}
+
+// runAlgorithm, if the pair of Hash and Index is built (see policiesBuilt). returns false on a bad name, or a pair that isn't built
+template <class Hash, class Index>
+bool runIfBuilt(char * alg, const char * layout, int keyRangeSize, int tableSize, int millisToRun, int totalThreads, workload * w, int batchSize, int migrationStep, int spikeMicros, memoryPolicy memory, resizePolicy resize, pinning_t pinning) {
+    if constexpr (policiesBuilt<Hash, Index>()) {
+        return runAlgorithm<Hash, Index>(alg, layout, keyRangeSize, tableSize, millisToRun, totalThreads, w, batchSize, migrationStep, spikeMicros, memory, resize, pinning);
+    } else {
+        if constexpr (is_same<Hash, IdentityHash>::value) {
+            cout<<"ERROR: -H identity is only built with -i pow2 (build with USER_DEFINES=\"-DALL_POLICY_COMBINATIONS\" for -i mod)"<<endl;
+        } else {
+            cout<<"ERROR: hash functions other than murmur3 are only built with -i fastrange (build with USER_DEFINES=\"-DALL_POLICY_COMBINATIONS\" for the others)"<<endl;
+        }
+        return false;
+    }
+}
+
+// run experiment for the selected algorithm, using the given hash policy and the indexing policy named by indexing. returns false on a bad name
+template <class Hash>
+bool runWithIndexing(const char * indexing, char * alg, const char * layout, int keyRangeSize, int tableSize, int millisToRun, int totalThreads, workload * w, int batchSize, int migrationStep, int spikeMicros, memoryPolicy memory, resizePolicy resize, pinning_t pinning) {
+    if (!strcmp(indexing, "mod")) return runIfBuilt<Hash, ModuloIndexing>(alg, layout, keyRangeSize, tableSize, millisToRun, totalThreads, w, batchSize, migrationStep, spikeMicros, memory, resize, pinning);
+    if (!strcmp(indexing, "fastrange")) return runIfBuilt<Hash, FastRangeIndexing>(alg, layout, keyRangeSize, tableSize, millisToRun, totalThreads, w, batchSize, migrationStep, spikeMicros, memory, resize, pinning);
+    if (!strcmp(indexing, "pow2")) return runIfBuilt<Hash, PowerOfTwoIndexing>(alg, layout, keyRangeSize, tableSize, millisToRun, totalThreads, w, batchSize, migrationStep, spikeMicros, memory, resize, pinning);
+    cout<<"Bad indexing policy name: "<<indexing<<endl;
+    return false;
+}
+
+// run experiment for the selected algorithm, using the hash and indexing policies named by hash and indexing. returns false on a bad name
+bool runWithHash(const char * hash, const char * indexing, char * alg, const char * layout, int keyRangeSize, int tableSize, int millisToRun, int totalThreads, workload * w, int batchSize, int migrationStep, int spikeMicros, memoryPolicy memory, resizePolicy resize, pinning_t pinning) {
+    if (!strcmp(hash, "murmur3")) return runWithIndexing<Murmur3Finalizer>(indexing, alg, layout, keyRangeSize, tableSize, millisToRun, totalThreads, w, batchSize, migrationStep, spikeMicros, memory, resize, pinning);
+    if (!strcmp(hash, "seeded")) return runWithIndexing<SeededMurmur3>(indexing, alg, layout, keyRangeSize, tableSize, millisToRun, totalThreads, w, batchSize, migrationStep, spikeMicros, memory, resize, pinning);
+    if (!strcmp(hash, "mix")) return runWithIndexing<MultiplyXorshiftHash>(indexing, alg, layout, keyRangeSize, tableSize, millisToRun, totalThreads, w, batchSize, migrationStep, spikeMicros, memory, resize, pinning);
+    if (!strcmp(hash, "crc32c")) return runWithIndexing<Crc32cHash>(indexing, alg, layout, keyRangeSize, tableSize, millisToRun, totalThreads, w, batchSize, migrationStep, spikeMicros, memory, resize, pinning);
+    if (!strcmp(hash, "identity")) return runWithIndexing<IdentityHash>(indexing, alg, layout, keyRangeSize, tableSize, millisToRun, totalThreads, w, batchSize, migrationStep, spikeMicros, memory, resize, pinning);
+    cout<<"Bad hash function name: "<<hash<<endl;
+    return false;
+}
+
 int main(int argc, char** argv) {
     if (argc == 1) {
         cout<<"USAGE: "<<argv[0]<<" [options]"<<endl;
         cout<<"Options:"<<endl;
-        cout<<"    -a  [string]   [a]lgorithm name in { A, B, C, D }"<<endl;
+        cout<<"    -a  [string]   [a]lgorithm name in { A, B, C, D, DM, E, K, R }"<<endl;
+        cout<<"                   A, B, K and R take locks (R: a seqlock per 64-slot segment, lock-free lookups); C, D, DM and E are lock-free. only D and DM expand:"<<endl;
+        cout<<"                   inserts into a full A, B, C, E or K fail (C's and E's erased slots stay used: their tombstones are never reused), and R holds at most sT + 1024 keys (its OVERFLOW_SLOTS), and warns at the end of a run if inserts failed"<<endl;
         cout<<"    -sT [int]      size of initial hash [T]able"<<endl;
         cout<<"    -m  [int]      [m]illiseconds to run"<<endl;
         cout<<"    -sR [int]      size of the key [R]ange that random keys will be drawn from (i.e., range [1, s])"<<endl;
         cout<<"    -t  [int]      number of [t]hreads that will perform inserts and deletes"<<endl;
+        cout<<"    -lf [float]    target [l]oad [f]actor: sets the key range to 2*lf*sT and prefills the table with a random half of it, the steady state of inserts and deletes (default 0: start empty)"<<endl;
+        cout<<"    -H  [string]   [H]ash function in { murmur3, seeded, mix, crc32c, identity } (default murmur3; identity is meant for pre-hashed keys)"<<endl;
+        cout<<"    -i  [string]   [i]ndexing policy that maps hashes to slots in { mod, fastrange, pow2 } (default fastrange, or pow2 with -H identity)"<<endl;
+        cout<<"                   hash functions other than murmur3 only with -i fastrange (identity only with -i pow2, never fastrange), unless built with USER_DEFINES=\"-DALL_POLICY_COMBINATIONS\""<<endl;
+        cout<<"    -l  [string]   bucket [l]ayout of A, B and C in { padded, packed, striped } (default padded),"<<endl;
+        cout<<"                   or, for A and B only, a table of LOCK_STRIPES locks in { locktable (seqlocks with optimistic reads), locktable-ttas, locktable-ticket }"<<endl;
+        cout<<"                   layouts other than padded need -H murmur3 -i fastrange, unless built with USER_DEFINES=\"-DALL_POLICY_COMBINATIONS\""<<endl;
+        cout<<"    -b  [int]      perform operations in [b]atches of this many keys, using the batched operations of C, D and DM (default 1: no batching)"<<endl;
+        cout<<"    -inc [int]     resize D and DM [inc]rementally: each insert and erase migrates at most this many old slots (default 0: migrate the whole table at once)"<<endl;
+        cout<<"    -lat [int]     record the [lat]ency of every operation (or batch), print p50/p99/p99.9/max per operation type and count operations slower than this many microseconds per 1s interval (default 0: off)"<<endl;
+        cout<<"    -numa [string] [numa] placement of D's and DM's tables in { firsttouch, interleave, partition } (default firsttouch)"<<endl;
+        cout<<"    -hp [string]   [h]uge [p]ages for D's and DM's tables in { off, thp, hugetlb } (default off)"<<endl;
+        cout<<"    -maxload [float] D and DM expand once more than this fraction of their slots are used (default 0.5)"<<endl;
+        cout<<"    -grow [float]  D and DM allocate this many slots per live key when they resize; must exceed 1/maxload (default 4)"<<endl;
+        cout<<"    -mincap [int]  D and DM never shrink below this many slots (default 0: -sT)"<<endl;
+        cout<<"    -sweep         run D or DM once for each of a grid of -maxload and -grow values, and print the throughput and table memory of each"<<endl;
+        cout<<"    -pin [string]  [pin] threads to CPUs in { none, compact, scatter }: compact fills one NUMA node before the next, scatter alternates nodes (default none)"<<endl;
+        cout<<"    -r  [int]      percentage of operations that are [r]eads (lookups); the rest are split evenly between inserts and deletes (default 0)"<<endl;
+        cout<<"    -d  [string]   key [d]istribution in { uniform, zipf[:theta], hotspot[:fraction[:probability]], sequential, trace:file } (default uniform; see workload.h)"<<endl;
+        cout<<"                   each thread precomputes its operations before the timer starts: 16000 per millisecond of -m, at least 2^20 and at most 2^28 for all threads together."<<endl;
+        cout<<"                   a thread that runs out replays them from the start, and the run prints a NOTE saying so"<<endl;
         cout<<endl;
         cout<<"Example: "<<argv[0]<<" -a D -m 10000 -sT 1000 -sR 1000000 -t 16"<<endl;
         return 1;
@@ -219,7 +584,21 @@ int main(int argc, char** argv) {
     int tableSize = 0;
     int keyRangeSize = 0;
     int totalThreads = 0;
+    int readPercent = 0;
+    int batchSize = 1;
+    int migrationStep = 0;
+    int spikeMicros = 0;
+    double loadFactor = 0;
+    resizePolicy resize;
+    bool sweep = false;
     char * alg = NULL;
+    const char * indexing = NULL; // fastrange, or pow2 with -H identity (see identityIndexingBuilt)
+    const char * hash = "murmur3";
+    const char * layout = "padded";
+    const char * distribution = "uniform";
+    const char * numa = "firsttouch";
+    const char * pin = "none";
+    const char * hugePages = "off";
     
     // read command line args
     for (int i=1;i<argc;++i) {
@@ -229,8 +608,40 @@ int main(int argc, char** argv) {
             keyRangeSize = atoi(argv[++i]);
         } else if (strcmp(argv[i], "-t") == 0) {
             totalThreads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-lf") == 0) {
+            loadFactor = atof(argv[++i]);
         } else if (strcmp(argv[i], "-m") == 0) {
             millisToRun = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-l") == 0) {
+            layout = argv[++i];
+        } else if (strcmp(argv[i], "-b") == 0) {
+            batchSize = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-inc") == 0) {
+            migrationStep = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-lat") == 0) {
+            spikeMicros = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-r") == 0) {
+            readPercent = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-numa") == 0) {
+            numa = argv[++i];
+        } else if (strcmp(argv[i], "-hp") == 0) {
+            hugePages = argv[++i];
+        } else if (strcmp(argv[i], "-maxload") == 0) {
+            resize.maxLoadFactor = atof(argv[++i]);
+        } else if (strcmp(argv[i], "-grow") == 0) {
+            resize.growthFactor = atof(argv[++i]);
+        } else if (strcmp(argv[i], "-mincap") == 0) {
+            resize.minCapacity = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-sweep") == 0) {
+            sweep = true;
+        } else if (strcmp(argv[i], "-pin") == 0) {
+            pin = argv[++i];
+        } else if (strcmp(argv[i], "-d") == 0) {
+            distribution = argv[++i];
+        } else if (strcmp(argv[i], "-H") == 0) {
+            hash = argv[++i];
+        } else if (strcmp(argv[i], "-i") == 0) {
+            indexing = argv[++i];
         } else if (strcmp(argv[i], "-a") == 0) {
             alg = argv[++i];
         } else {
@@ -239,6 +650,23 @@ int main(int argc, char** argv) {
         }
     }
     
+    // a set that holds a random half of the key range stays that full, in expectation, under an even mix of inserts and deletes
+    if (loadFactor != 0) {
+        if (!(loadFactor > 0 && loadFactor < 1) || tableSize < 1 || keyRangeSize != 0) {
+            cout<<"ERROR: -lf needs a loadFactor in (0, 1) and -sT, and sets the key range itself (no -sR)"<<endl;
+            return 1;
+        }
+        keyRangeSize = (int) (2 * loadFactor * tableSize);
+    }
+    
+    if (indexing == NULL) {
+        indexing = strcmp(hash, "identity") ? "fastrange" : "pow2";
+    }
+    if (!strcmp(hash, "identity") && !strcmp(indexing, "fastrange")) {
+        cout<<"ERROR: -H identity can't be used with -i fastrange, which would send every key of the key range to slot 0 (use -i pow2 or mod)"<<endl;
+        return 1;
+    }
+    
     // print command and args for debugging
     std::cout<<"Cmd:";
     for (int i=0;i<argc;++i) {
@@ -252,7 +680,25 @@ int main(int argc, char** argv) {
     PRINT(keyRangeSize);
     PRINT(tableSize);
     PRINT(totalThreads);
+    PRINT(loadFactor);
+    PRINT(readPercent);
+    PRINT(distribution);
+    PRINT(batchSize);
+    PRINT(migrationStep);
+    PRINT(spikeMicros);
     PRINT(alg);
+    PRINT(hash);
+    PRINT(indexing);
+    PRINT(layout);
+    PRINT(numa);
+    PRINT(hugePages);
+    PRINT(pin);
+    PRINT(resize.maxLoadFactor);
+    PRINT(resize.growthFactor);
+    PRINT(resize.minCapacity);
+    PRINT(sweep);
+    int numaNodes = numaTopology::get().numNodes();
+    PRINT(numaNodes);
     cout<<endl;
     
     // check for too large thread count
@@ -261,27 +707,101 @@ int main(int argc, char** argv) {
         return 1;
     }
     
+    // check for a sensible operation mix
+    if (readPercent < 0 || readPercent > 100) {
+        cout<<"ERROR: readPercent="<<readPercent<<" must be in [0, 100]"<<endl;
+        return 1;
+    }
+    
+    if (migrationStep < 0) {
+        cout<<"ERROR: migrationStep="<<migrationStep<<" must not be negative"<<endl;
+        return 1;
+    }
+    
+    if (spikeMicros < 0) {
+        cout<<"ERROR: spikeMicros="<<spikeMicros<<" must not be negative"<<endl;
+        return 1;
+    }
+    
+    if (batchSize < 1) {
+        cout<<"ERROR: batchSize="<<batchSize<<" must be at least 1"<<endl;
+        return 1;
+    }
+    
     // check for missing alg name
     if (alg == NULL) {
         cout<<"Must specify algorithm name"<<endl;
         return 1;
     }
     
-    // run experiment for the selected algorithm
-    if (!strcmp(alg, "A")) {
-        runExperiment<AlgorithmA>(keyRangeSize, tableSize, millisToRun, totalThreads);
+    if (keyRangeSize < 1) {
+        cout<<"ERROR: keyRangeSize="<<keyRangeSize<<" must be at least 1"<<endl;
+        return 1;
     }
-	else if (!strcmp(alg, "B")) {
-         runExperiment<AlgorithmB>(keyRangeSize, tableSize, millisToRun, totalThreads);
+    
+    if (!(resize.maxLoadFactor > 0 && resize.maxLoadFactor < 1) || !(resize.growthFactor * resize.maxLoadFactor > 1) || resize.minCapacity < 0) {
+        cout<<"ERROR: maxLoadFactor="<<resize.maxLoadFactor<<" must be in (0, 1), growthFactor="<<resize.growthFactor<<" more than 1/maxLoadFactor, and minCapacity="<<resize.minCapacity<<" not negative"<<endl;
+        return 1;
     }
-	else if (!strcmp(alg, "C")) {
-         runExperiment<AlgorithmC>(keyRangeSize, tableSize, millisToRun, totalThreads);
+    
+    if (sweep && strcmp(alg, "D") && strcmp(alg, "DM")) {
+        cout<<"ERROR: -sweep needs a resizable algorithm (D or DM)"<<endl;
+        return 1;
     }
-	else if (!strcmp(alg, "D")) {
-         runExperiment<AlgorithmD>(keyRangeSize, tableSize, millisToRun, totalThreads);
+    
+    memoryPolicy memory;
+    if (!strcmp(numa, "firsttouch")) memory.placement = NUMA_FIRST_TOUCH;
+    else if (!strcmp(numa, "interleave")) memory.placement = NUMA_INTERLEAVE;
+    else if (!strcmp(numa, "partition")) memory.placement = NUMA_PARTITION;
+    else {
+        cout<<"Bad NUMA placement: "<<numa<<endl;
+        return 1;
     }
- 	else {
-        cout<<"Bad algorithm name: "<<alg<<endl;
+    if (!strcmp(hugePages, "off")) memory.pages = HUGE_PAGES_OFF;
+    else if (!strcmp(hugePages, "thp")) memory.pages = HUGE_PAGES_THP;
+    else if (!strcmp(hugePages, "hugetlb")) memory.pages = HUGE_PAGES_HUGETLB;
+    else {
+        cout<<"Bad huge page policy: "<<hugePages<<endl;
+        return 1;
+    }
+    
+    pinning_t pinning;
+    if (!strcmp(pin, "none")) pinning = PIN_NONE;
+    else if (!strcmp(pin, "compact")) pinning = PIN_COMPACT;
+    else if (!strcmp(pin, "scatter")) pinning = PIN_SCATTER;
+    else {
+        cout<<"Bad thread pinning: "<<pin<<endl;
+        return 1;
+    }
+    
+    workload w;
+    if (!w.init(distribution, keyRangeSize, readPercent)) {
+        return 1;
+    }
+    if (loadFactor != 0) w.prefillFraction = 0.5;
+    
+    // -sweep: one trial per resize policy of a grid of load and growth factors (each with -mincap), then throughput against table memory for all of them
+    if (sweep) {
+        for (double maxLoadFactor : { 0.5, 0.7, 0.9 }) {
+            for (double growthFactor : { 4., 2., 1.5 }) {
+                if (maxLoadFactor * growthFactor <= 1) continue; // a new table would already be over its threshold
+                resize.maxLoadFactor = maxLoadFactor;
+                resize.growthFactor = growthFactor;
+                cout<<"sweep: maxLoadFactor="<<maxLoadFactor<<" growthFactor="<<growthFactor<<endl;
+                if (!runWithHash(hash, indexing, alg, layout, keyRangeSize, tableSize, millisToRun, totalThreads, &w, batchSize, migrationStep, spikeMicros, memory, resize, pinning)) {
+                    return 1;
+                }
+            }
+        }
+        printf("%-14s %-14s %-14s %-16s %s\n", "maxLoadFactor", "growthFactor", "throughput", "peak table MB", "end table MB");
+        for (auto & point : sweepPoints) {
+            printf("%-14g %-14g %-14lld %-16.2f %.2f\n", point.resize.maxLoadFactor, point.resize.growthFactor, point.throughput, point.peakBytes / 1e6, point.endBytes / 1e6);
+        }
+        return 0;
+    }
+    
+    // run experiment for the selected algorithm, hash function and indexing policy
+    if (!runWithHash(hash, indexing, alg, layout, keyRangeSize, tableSize, millisToRun, totalThreads, &w, batchSize, migrationStep, spikeMicros, memory, resize, pinning)) {
         return 1;
     }
     
@@ -0,0 +1,409 @@
+/**
+ * Checks of the table APIs that the benchmark doesn't run: each check fills a table through one of them,
+ * and compares what the table then holds with what it should. Run with make check, which exits with status 1 if any check fails.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+
+#include "util.h"
+#include "alg_a.h"
+#include "alg_b.h"
+#include "alg_c.h"
+#include "alg_d.h"
+#include "alg_d_map.h"
+#include "alg_d_wide.h"
+#include "alg_d_string.h"
+#include "alg_e.h"
+#include "alg_k.h"
+#include "alg_r.h"
+
+using namespace std;
+
+int failures = 0;
+
+// print the outcome of one check
+void report(const char * name, const bool ok) {
+    cout<<(ok ? "OK.     " : "FAILED. ")<<name<<endl;
+    if(!ok) failures++;
+}
+
+// n random keys in [1, range], with duplicates whenever n is a sizeable fraction of range
+vector<int> randomKeys(const int n, const int range, const unsigned seed) {
+    mt19937 rng(seed);
+    uniform_int_distribution<int> dist(1, range);
+    vector<int> keys(n);
+    for(int & key : keys)
+        key = dist(rng);
+    return keys;
+}
+
+// whether s holds exactly the keys of expected: every key in [1, range] is in s iff it is in expected, and the sums of the keys agree
+template <class Set>
+bool holdsExactly(Set & s, const set<int> & expected, const int range) {
+    for(int key = 1; key <= range; key++)
+        if(s.contains(0, key) != (expected.count(key) > 0))
+            return false;
+    int64_t sum = 0;
+    for(const int key : expected)
+        sum += key;
+    return s.getSumOfKeys() == sum;
+}
+
+// erase every other key of expected from s, and draw as many random keys to insert, so that a table built in bulk must also work for operations
+// (and stay within C's capacity, which counts the tombstones of the erased keys)
+template <class Set>
+bool churn(Set & s, set<int> & expected, const int range, const unsigned seed) {
+    bool ok = true;
+    int visited = 0;
+    for(auto it = expected.begin(); it != expected.end(); visited++) {
+        if(visited % 2) {
+            ok &= s.erase(0, *it);
+            it = expected.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    for(const int key : randomKeys(visited / 2, range, seed))
+        ok &= (s.insertIfAbsent(0, key) == expected.insert(key).second);
+    return ok;
+}
+
+// the bulk-load constructors of C and D: the table holds the keys (duplicates once), and takes inserts and erases afterwards
+void checkBulkLoad() {
+    const int range = 1 << 20;
+    const vector<int> keys = randomKeys(range / 4, range, 1);
+    set<int> expected(keys.begin(), keys.end());
+    {
+        AlgorithmC<> c(1, span<const int>(keys));
+        report("C bulk load holds the keys", holdsExactly(c, expected, range));
+        set<int> after = expected;
+        report("C bulk-loaded table takes inserts and erases", churn(c, after, range, 2) && holdsExactly(c, after, range));
+    }
+    {
+        AlgorithmD<> d(1, span<const int>(keys));
+        report("D bulk load holds the keys", holdsExactly(d, expected, range));
+        set<int> after = expected;
+        report("D bulk-loaded table takes inserts and erases", churn(d, after, range, 2) && holdsExactly(d, after, range));
+    }
+    {
+        AlgorithmDMap<> dm(1, span<const int>(keys));
+        report("DM bulk load holds the keys", holdsExactly(dm, expected, range));
+    }
+}
+
+// saveSnapshot() and loadSnapshot() of D and DM: a table loaded from a snapshot holds the keys (and values) that were saved, both when the file is mapped as is
+// and when its keys are rehashed for a table with another indexing policy, and it takes operations afterwards. a file that isn't a snapshot is refused
+void checkSnapshots() {
+    const int range = 1 << 20;
+    const string path = "/tmp/check-" + to_string(getpid()) + ".snapshot";
+    set<int> expected;
+    {
+        AlgorithmD<> saved(1, 1024); // grows several times while it is filled
+        for(const int key : randomKeys(range / 4, range, 3)) {
+            saved.insertIfAbsent(0, key);
+            expected.insert(key);
+        }
+        for(const int key : randomKeys(range / 8, range, 4)) {
+            saved.erase(0, key);
+            expected.erase(key);
+        }
+        report("D snapshot saved", saved.saveSnapshot(0, path.c_str()));
+    }
+    {
+        AlgorithmD<> loaded(1, 1024);
+        report("D snapshot loaded into the same kind of table (mapped) holds the keys", loaded.loadSnapshot(path.c_str()) && holdsExactly(loaded, expected, range));
+        set<int> after = expected;
+        report("D table loaded from a snapshot takes inserts and erases", churn(loaded, after, range, 5) && holdsExactly(loaded, after, range));
+    }
+    {
+        AlgorithmD<KeySlot, Murmur3Finalizer, PowerOfTwoIndexing> rehashed(1, 1024);
+        report("D snapshot loaded with another indexing policy (rehashed) holds the keys", rehashed.loadSnapshot(path.c_str()) && holdsExactly(rehashed, expected, range));
+    }
+    {
+        AlgorithmDMap<> saved(1, 1024);
+        for(const int key : randomKeys(range / 4, range, 6))
+            saved.insertIfAbsent(0, key, (uint32_t) key * 7);
+        report("DM snapshot saved", saved.saveSnapshot(0, path.c_str()));
+        AlgorithmDMap<> loaded(1, 1024);
+        bool ok = loaded.loadSnapshot(path.c_str());
+        for(int key = 1; ok && key <= range; key++) {
+            uint32_t value, savedValue;
+            const bool found = loaded.get(0, key, value);
+            ok = (found == saved.get(0, key, savedValue)) && (!found || value == (uint32_t) key * 7);
+        }
+        report("DM snapshot holds the keys and their values", ok);
+    }
+    {
+        FILE * f = fopen(path.c_str(), "w");
+        fputs("not a snapshot", f);
+        fclose(f);
+        AlgorithmD<> d(1, 1024);
+        d.insertIfAbsent(0, 42);
+        report("D refuses a file that isn't a snapshot, and keeps its keys", !d.loadSnapshot(path.c_str()) && holdsExactly(d, set<int> { 42 }, 1000));
+    }
+    unlink(path.c_str());
+}
+
+// the keys forEach() visits in s (once per visit), sorted. D's forEach() also passes a value, which is ignored
+template <class Set>
+vector<int> visitedKeys(Set & s, const int tid) {
+    vector<vector<int>> visitedOfThread(omp_get_max_threads());
+    s.forEach(tid, [&](const int key, const auto &... value) { visitedOfThread[omp_get_thread_num()].push_back(key); });
+    vector<int> visited;
+    for(auto & keys : visitedOfThread)
+        visited.insert(visited.end(), keys.begin(), keys.end());
+    sort(visited.begin(), visited.end());
+    return visited;
+}
+
+// whether forEach() visits every key of expected exactly once (and no other key), and reduce() counts and sums them, in a table no other thread is using
+template <class Set>
+bool scansExactly(Set & s, const set<int> & expected) {
+    const int64_t count = s.reduce(0, (int64_t) 0, [](const int key, const auto &... value) { return (int64_t) 1; }, plus<int64_t>());
+    const int64_t sum = s.reduce(0, (int64_t) 0, [](const int key, const auto &... value) { return (int64_t) key; }, plus<int64_t>());
+    int64_t expectedSum = 0;
+    for(const int key : expected)
+        expectedSum += key;
+    return visitedKeys(s, 0) == vector<int>(expected.begin(), expected.end()) && count == (int64_t) expected.size() && sum == expectedSum;
+}
+
+// fill s with random keys of [1, range] (inserting some, then erasing some), and check its scans
+template <class Set>
+void checkScansOf(const char * name, Set & s, const int range) {
+    set<int> expected;
+    for(const int key : randomKeys(range / 4, range, 7)) {
+        s.insertIfAbsent(0, key);
+        expected.insert(key);
+    }
+    for(const int key : randomKeys(range / 8, range, 8)) {
+        s.erase(0, key);
+        expected.erase(key);
+    }
+    report((string(name) + " forEach and reduce see every key once").c_str(), scansExactly(s, expected));
+}
+
+// while two threads insert and erase the odd keys of [1, range] in s, scan s over and over: the even keys, which are in s throughout, must be visited
+// exactly once by each forEach() (at least once for D, whose forEach may visit a key twice if the table is replaced during the scan), and counted once by each reduce()
+template <class Set>
+void checkConcurrentScansOf(const char * name, Set & s, const int range, const bool mayRevisit) {
+    set<int> stable;
+    for(int key = 2; key <= range; key += 2) {
+        s.insertIfAbsent(0, key);
+        stable.insert(key);
+    }
+    atomic<bool> done(false);
+    vector<thread> writers;
+    for(int tid = 1; tid <= 2; tid++) {
+        writers.emplace_back([&, tid]() {
+            mt19937 rng(tid);
+            uniform_int_distribution<int> dist(0, range / 2 - 1);
+            while(!done) {
+                const int key = 2 * dist(rng) + 1;
+                if(rng() % 2) s.insertIfAbsent(tid, key);
+                else s.erase(tid, key);
+            }
+        });
+    }
+    bool ok = true;
+    for(int scan = 0; scan < 20 && ok; scan++) {
+        vector<int> visited = visitedKeys(s, 0);
+        visited.erase(remove_if(visited.begin(), visited.end(), [](const int key) { return key % 2; }), visited.end());
+        if(mayRevisit)
+            visited.erase(unique(visited.begin(), visited.end()), visited.end());
+        const int64_t evenKeys = s.reduce(0, (int64_t) 0, [](const int key, const auto &... value) { return (int64_t) (key % 2 == 0); }, plus<int64_t>());
+        ok = visited == vector<int>(stable.begin(), stable.end()) && evenKeys == (int64_t) stable.size();
+    }
+    done = true;
+    for(thread & writer : writers)
+        writer.join();
+    report((string(name) + " forEach and reduce see every key that stays in the set while other threads insert and erase").c_str(), ok);
+}
+
+// forEach() and reduce() of every algorithm, in a quiet table, in a D table whose incremental migrations are in flight when it is scanned,
+// and while other threads operate on C and D
+void checkScans() {
+    const int range = 1 << 18;
+    { AlgorithmA<> a(1, 2 * range); checkScansOf("A", a, range); }
+    { AlgorithmB<> b(1, 2 * range); checkScansOf("B", b, range); }
+    { AlgorithmC<> c(1, 2 * range); checkScansOf("C", c, range); }
+    { AlgorithmE<> e(1, 2 * range); checkScansOf("E", e, range); }
+    { AlgorithmK<> k(1, 2 * range); checkScansOf("K", k, range); }
+    { AlgorithmR<> r(1, 2 * range); checkScansOf("R", r, range); }
+    { AlgorithmD<> d(1, 1024); checkScansOf("D", d, range); }
+    { AlgorithmDMap<> dm(1, 1024); checkScansOf("DM", dm, range); }
+    {
+        AlgorithmD<> d(1, 1024, 64);
+        set<int> expected;
+        bool ok = true;
+        const vector<int> keys = randomKeys(range / 4, range, 9);
+        for(size_t i = 0; i < keys.size() && ok; i++) {
+            d.insertIfAbsent(0, keys[i]);
+            expected.insert(keys[i]);
+            if(i % 5000 == 0)
+                ok = scansExactly(d, expected);
+        }
+        report("D forEach and reduce see every key once while resizing incrementally", ok);
+    }
+    { AlgorithmC<> c(3, range); checkConcurrentScansOf("C", c, range / 2, false); }
+    { AlgorithmD<> d(3, 1024); checkConcurrentScansOf("D", d, range / 2, true); }
+}
+
+// the key of type Key that stands for i in the wide-key checks: i spread over every bit of the key
+template <class Key>
+Key wideKey(const int i) {
+    Key key;
+    uint64_t bits = (uint64_t) i * 0x9E3779B97F4A7C15ULL;
+    for(size_t b = 0; b < sizeof(Key); b += sizeof(bits), bits = bits * 0x9E3779B97F4A7C15ULL + 1)
+        memcpy((char *) &key + b, &bits, min(sizeof(bits), sizeof(Key) - b));
+    return key;
+}
+
+// the keys wideKey(1..n), followed by the all-zero key and the two keys that C reserves for empty and erased slots (which are still keys of the set)
+template <class Key>
+vector<Key> wideKeys(const int n) {
+    vector<Key> keys;
+    for(int i = 1; i <= n; i++)
+        keys.push_back(wideKey<Key>(i));
+    keys.push_back(Key {});
+    keys.push_back(reservedKeys<Key>::empty());
+    keys.push_back(reservedKeys<Key>::tombstone());
+    return keys;
+}
+
+// random inserts (two thirds) and erases of keys of universe on s, each of which must return what it does to a std::set. afterwards every key of universe
+// must be in s iff it is in the std::set, and the sums of their keyChecksum() must agree
+template <class Set, class Key>
+bool keysWork(Set & s, const vector<Key> & universe, const unsigned seed) {
+    set<Key> expected;
+    mt19937 rng(seed);
+    bool ok = true;
+    for(size_t op = 0; op < 4 * universe.size(); op++) {
+        const Key & key = universe[rng() % universe.size()];
+        if(rng() % 3) ok &= (s.insertIfAbsent(0, key) == expected.insert(key).second);
+        else ok &= (s.erase(0, key) == (expected.erase(key) > 0));
+    }
+    for(const Key & key : universe)
+        ok &= (s.contains(0, key) == (expected.count(key) > 0));
+    int64_t sum = 0;
+    for(const Key & key : expected)
+        sum += keyChecksum(key);
+    return ok && s.getSumOfKeys() == sum;
+}
+
+// whether s holds every (distinct) key of keys, and no other key: the sums of their keyChecksum() agree
+template <class Set, class Key>
+bool holdsAll(Set & s, const vector<Key> & keys) {
+    int64_t sum = 0;
+    for(const Key & key : keys) {
+        if(!s.contains(0, key))
+            return false;
+        sum += keyChecksum(key);
+    }
+    return s.getSumOfKeys() == sum;
+}
+
+// C with 64-bit and 16-byte keys, and D with the same keys in out-of-line records (alg_d_wide.h), as a set and as a map, filled by operations and in bulk
+void checkWideKeys() {
+    const int n = 1 << 16;
+    const vector<int64_t> keys64 = wideKeys<int64_t>(n);
+    const vector<fixedKey<16>> keys128 = wideKeys<fixedKey<16>>(n);
+    { AlgorithmC<Murmur3Finalizer, FastRangeIndexing, PaddedLayout, int64_t> c(1, 4 * n); report("C with int64_t keys", keysWork(c, keys64, 10)); }
+    { AlgorithmC<Murmur3Finalizer, FastRangeIndexing, PaddedLayout, fixedKey<16>> c(1, 4 * n); report("C with fixedKey<16> keys", keysWork(c, keys128, 11)); }
+    { AlgorithmDWide<int64_t> d(1, 1024); report("D with int64_t keys", keysWork(d, keys64, 12)); }
+    { AlgorithmDWide<fixedKey<16>> d(1, 1024, 64); report("D with fixedKey<16> keys, resizing incrementally", keysWork(d, keys128, 13)); }
+    { AlgorithmC<Murmur3Finalizer, FastRangeIndexing, PaddedLayout, fixedKey<16>> c(1, span<const fixedKey<16>>(keys128)); report("C bulk load with fixedKey<16> keys", holdsAll(c, keys128)); }
+    { AlgorithmDWide<int64_t> d(1, span<const int64_t>(keys64)); report("D bulk load with int64_t keys", holdsAll(d, keys64)); }
+    {
+        AlgorithmDWideMap<fixedKey<16>, int64_t> dm(1, 1024);
+        bool ok = true;
+        for(int i = 0; i < n; i++)
+            ok &= dm.insertIfAbsent(0, keys128[i], (int64_t) i);
+        for(int i = 0; i < n; i += 2)
+            ok &= dm.update(0, keys128[i], -(int64_t) i);
+        for(int i = 0; i < n; i += 3)
+            ok &= dm.erase(0, keys128[i]);
+        for(int i = 0; i < n && ok; i++) {
+            int64_t value;
+            const bool found = dm.get(0, keys128[i], value);
+            ok = (found == (i % 3 != 0)) && (!found || value == (i % 2 ? i : -(int64_t) i));
+        }
+        report("D map with fixedKey<16> keys and int64_t values", ok);
+    }
+}
+
+// n strings of 0 to 100 bytes (some only differing in their last byte, some with zero bytes), and two of several MB, which get arena blocks of their own
+vector<string> stringKeys(const int n) {
+    mt19937 rng(14);
+    vector<string> keys;
+    for(int i = 0; i < n; i++) {
+        string key = "key/" + to_string(i);
+        key.resize(rng() % 101, (char) (i % 3));
+        keys.push_back(key);
+    }
+    keys.push_back(string(3 << 20, 'x'));
+    keys.push_back(string(9 << 20, 'y'));
+    keys.push_back("");
+    sort(keys.begin(), keys.end());
+    keys.erase(unique(keys.begin(), keys.end()), keys.end());
+    return keys;
+}
+
+// D with string keys (alg_d_string.h): operations, forEach, the bulk-load constructor, and threads inserting the same keys at once (each key must be inserted once)
+void checkStringKeys() {
+    const vector<string> strings = stringKeys(1 << 15);
+    const vector<string_view> keys(strings.begin(), strings.end());
+    { AlgorithmDString<> d(1, 1024); report("D with string keys", keysWork(d, keys, 15)); }
+    { AlgorithmDString<> d(1, 1024, 64); report("D with string keys, resizing incrementally", keysWork(d, keys, 16)); }
+    {
+        AlgorithmDString<> d(1, span<const string_view>(keys));
+        vector<vector<string_view>> visitedOfThread(omp_get_max_threads());
+        d.forEach(0, [&](const string_view & key, const int value) { visitedOfThread[omp_get_thread_num()].push_back(key); });
+        vector<string_view> visited;
+        for(auto & keysOfThread : visitedOfThread)
+            visited.insert(visited.end(), keysOfThread.begin(), keysOfThread.end());
+        sort(visited.begin(), visited.end());
+        report("D bulk load with string keys, and forEach over them", holdsAll(d, keys) && visited == keys);
+    }
+    {
+        AlgorithmDString<> d(3, 1024);
+        atomic<int> inserted(0);
+        vector<thread> threads;
+        for(int tid = 0; tid < 3; tid++) {
+            threads.emplace_back([&, tid]() {
+                vector<string_view> order = keys;
+                shuffle(order.begin(), order.end(), mt19937(tid));
+                for(const string_view & key : order)
+                    if(d.insertIfAbsent(tid, key))
+                        inserted++;
+            });
+        }
+        for(thread & t : threads)
+            t.join();
+        report("D with string keys inserted by several threads at once", inserted == (int) keys.size() && holdsAll(d, keys));
+    }
+}
+
+int main(int argc, char** argv) {
+    checkBulkLoad();
+    checkSnapshots();
+    checkScans();
+    checkWideKeys();
+    checkStringKeys();
+    if(failures) {
+        cout<<"FAILED: "<<failures<<" checks"<<endl;
+        return 1;
+    }
+    cout<<"All checks passed."<<endl;
+    return 0;
+}
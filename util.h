@@ -1,9 +1,32 @@
 #ifndef UTIL_H
 #define UTIL_H
 
+#include <algorithm>
 #include <chrono>
+#include <iostream>
 #include <atomic>
 #include <sstream>
+#include <string>
+#include <string_view>
+#include <mutex>
+#include <vector>
+#include <random>
+#include <type_traits>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <fstream>
+#include <thread>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include <span>
+#include <omp.h>
+#if defined(__SSE4_2__)
+#include <nmmintrin.h>
+#endif
 using namespace std;
 
 #ifndef MAX_THREADS
@@ -14,6 +37,10 @@ using namespace std;
 #define PADDING_BYTES 64
 #endif
 
+#ifndef LOCK_STRIPES
+#define LOCK_STRIPES 4096   // default number of locks in a LockTableLayout
+#endif
+
 #ifndef DEBUG
 #define DEBUG if(0)
 #define DEBUG1 if(0)
@@ -24,6 +51,10 @@ using namespace std;
 #define VERBOSE if(0)
 #endif
 
+#ifndef STATS
+#define STATS if(0)     // build with USER_DEFINES="-DSTATS=if\(1\)" to collect hashStats
+#endif
+
 #ifndef TRACE
 #define TRACE if(0)
 #endif
@@ -62,6 +93,10 @@ public:
         }
         return -1; // dummy return value
     }
+    // adds n at once, e.g., the keys a bulk load placed without going through inc()
+    void add(int64_t n) {
+        globalCounter.fetch_add(n);
+    }
     int64_t get() {
         return globalCounter;
     }
@@ -156,8 +191,227 @@ public:
     }
 } __attribute__((aligned(PADDING_BYTES)));
 
-uint32_t murmur3(uint32_t key) {
-    constexpr uint32_t seed = 0x1a8b714c;
+/**
+ * HDR-style histogram of latencies (or any non-negative 64-bit values) with a bounded relative error.
+ *
+ * values below SUB_BUCKETS are counted exactly. above that, every power-of-two range [2^e, 2^(e+1)) is split into SUB_BUCKETS/2 equal
+ * sub-buckets, so a reported value is at most 1/(SUB_BUCKETS/2) (~3%) above the recorded one, whatever its magnitude.
+ * record() is a plain increment: a histogram has a single writer (give each thread its own and merge() them after the threads are joined).
+ */
+class latencyHistogram {
+public:
+    static constexpr int SUB_BUCKET_BITS = 6;
+    static constexpr int SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+    static constexpr int NUM_BUCKETS = (64 - SUB_BUCKET_BITS + 2) * (SUB_BUCKETS / 2);
+private:
+    char padding0[PADDING_BYTES];
+    uint64_t counts[NUM_BUCKETS];
+    uint64_t total;
+    uint64_t maxValue;
+    char padding1[PADDING_BYTES];
+
+    static int bucketOf(const uint64_t v) {
+        if(v < SUB_BUCKETS)
+            return (int) v;
+        const int shift = 63 - __builtin_clzll(v) - (SUB_BUCKET_BITS - 1);  // v >> shift is in [SUB_BUCKETS/2, SUB_BUCKETS)
+        return shift * (SUB_BUCKETS / 2) + (int) (v >> shift);
+    }
+    // largest value that lands in bucket b
+    static uint64_t highestValueOf(const int b) {
+        if(b < SUB_BUCKETS)
+            return b;
+        const int shift = b / (SUB_BUCKETS / 2) - 1;
+        const uint64_t sub = b % (SUB_BUCKETS / 2) + SUB_BUCKETS / 2;
+        return ((sub + 1) << shift) - 1;
+    }
+public:
+    latencyHistogram() {
+        clear();
+    }
+    void clear() {
+        memset(counts, 0, sizeof(counts));
+        total = 0;
+        maxValue = 0;
+    }
+    void record(const uint64_t v) {
+        ++counts[bucketOf(v)];
+        ++total;
+        if(v > maxValue)
+            maxValue = v;
+    }
+    void merge(const latencyHistogram & other) {
+        for(int b = 0; b < NUM_BUCKETS; b++)
+            counts[b] += other.counts[b];
+        total += other.total;
+        if(other.maxValue > maxValue)
+            maxValue = other.maxValue;
+    }
+    uint64_t getCount() {
+        return total;
+    }
+    uint64_t getMax() {
+        return maxValue;
+    }
+    // returns the smallest recorded value v (up to the bucket precision) such that at least the given percentile of all values are <= v
+    uint64_t getPercentile(const double percentile) {
+        if(total == 0)
+            return 0;
+        uint64_t rank = (uint64_t) (percentile / 100. * total + 0.5);
+        if(rank < 1)
+            rank = 1;
+        uint64_t seen = 0;
+        for(int b = 0; b < NUM_BUCKETS; b++) {
+            seen += counts[b];
+            if(seen >= rank)
+                return min(highestValueOf(b), maxValue);
+        }
+        return maxValue;
+    }
+};
+
+/**
+ * instrumentation shared by the hash tables: probe lengths, contention and resizing activity, counted per thread in debugCounters.
+ * a table only allocates its hashStats, and only executes the statements that update it, when built with STATS enabled (see the STATS macro),
+ * so regular builds pay neither the memory nor a single instruction for it.
+ */
+class hashStats {
+public:
+    static constexpr int PROBE_BUCKETS = 32;
+    debugCounter probeLengths[PROBE_BUCKETS];  // bucket 0 counts probes of length 1, and bucket b > 0 probes of length (2^(b-1), 2^b]
+    debugCounter casFailures;                   // CASes on a slot that lost to a concurrent update
+    debugCounter markedRetries;                 // operations restarted because they found a slot frozen by a migration (MARKED_MASK)
+    debugCounter expansions;                    // new tables published (expansions and rebuilds)
+    debugCounter chunksMigrated;
+
+    // an operation examined len slots (or groups) before it could answer
+    void recordProbe(const int tid, const long long len) {
+        int b = (len <= 1) ? 0 : 64 - __builtin_clzll(len - 1);
+        probeLengths[min(b, PROBE_BUCKETS - 1)].inc(tid);
+    }
+
+    static void printSlotCounts(const char * name, const long long live, const long long tombstones, const long long empty) {
+        const long long slots = live + tombstones + empty;
+        cout<<name<<": "<<slots<<" slots, "<<live<<" live ("<<(100. * live / slots)<<"%), "<<tombstones<<" tombstones ("<<(100. * tombstones / slots)<<"%), "
+            <<empty<<" empty ("<<(100. * empty / slots)<<"%)"<<endl;
+    }
+
+    void print(const int numThreads) {
+        long long probes = 0;
+        for(int b = 0; b < PROBE_BUCKETS; b++)
+            probes += probeLengths[b].getTotal();
+        cout<<"probe lengths ("<<probes<<" operations):"<<endl;
+        for(int b = 0; b < PROBE_BUCKETS; b++) {
+            long long n = probeLengths[b].getTotal();
+            if(n == 0) continue;
+            long long lo = (b == 0) ? 1 : (1LL << (b - 1)) + 1;
+            long long hi = 1LL << b;
+            stringstream range;
+            range<<lo;
+            if(hi > lo) range<<"-"<<hi;
+            printf("    %-14s %-14lld %.3f%%\n", range.str().c_str(), n, 100. * n / probes);
+        }
+        cout<<"cas failures   : "<<casFailures.getTotal()<<endl;
+        cout<<"marked retries : "<<markedRetries.getTotal()<<endl;
+        for(auto perThread : { make_pair("expansions     :", &expansions), make_pair("chunks migrated:", &chunksMigrated) }) {
+            cout<<perThread.first<<" "<<perThread.second->getTotal();
+            if(perThread.second->getTotal() > 0) {
+                cout<<" (per thread:";
+                for(int tid = 0; tid < numThreads; tid++) cout<<" "<<perThread.second->get(tid);
+                cout<<")";
+            }
+            cout<<endl;
+        }
+    }
+};
+
+/**
+ * epoch-based reclamation for memory that concurrent operations may still be reading after it has been unlinked (e.g., the arrays of a replaced hash table).
+ *
+ * every operation starts with enter(tid). when the global epoch hasn't moved this is just two plain loads and a compare (no atomic RMW, no fence),
+ * so the fast path of a data structure doesn't pay for reclamation. only when the epoch has moved does the thread announce the new epoch (store + fence)
+ * and try to advance it further. an object retired in epoch e is freed once the global epoch reaches e+2: by then every thread that isn't quiescent
+ * has started a new operation after the object was unlinked, so nobody can still reach it.
+ *
+ * a thread that stops using the data structure for a long time should call quiesce(tid), so that it doesn't hold back reclamation.
+ */
+class epochReclaimer {
+private:
+    static constexpr int64_t QUIESCENT = -1;
+    static constexpr int NUM_BAGS = 3;  // objects retired in epochs e-1 and e may still be reachable, those retired in e-2 are safe to free
+
+    struct PaddedEpoch {
+        atomic<int64_t> v;
+        char padding[PADDING_BYTES - sizeof(atomic<int64_t>)];
+    };
+    struct retiredObject {
+        void * ptr;
+        void (*deleter)(void *);
+    };
+
+    char padding0[PADDING_BYTES];
+    PaddedEpoch announced[MAX_THREADS];
+    atomic<int64_t> globalEpoch;
+    char padding1[PADDING_BYTES];
+    atomic<int> pending;                // number of retired objects that haven't been freed yet
+    const int numThreads;
+    mutex limboLock;                    // retiring and freeing only happen on (rare) slow paths such as the end of a table expansion
+    vector<retiredObject> limbo[NUM_BAGS];  // limbo[e % NUM_BAGS] holds the objects retired in epoch e
+    char padding2[PADDING_BYTES];
+
+    void freeBag(vector<retiredObject> & bag) {
+        for (auto & obj : bag) obj.deleter(obj.ptr);
+        pending.fetch_sub(bag.size());
+        bag.clear();
+    }
+
+    // advance the global epoch from e to e+1 if every thread that isn't quiescent has announced e
+    void tryAdvance(const int64_t e) {
+        for (int i=0;i<numThreads;++i) {
+            int64_t a = announced[i].v.load(memory_order_acquire);
+            if (a != QUIESCENT && a != e) return;
+        }
+        lock_guard<mutex> lock(limboLock);
+        if (globalEpoch.load(memory_order_relaxed) != e) return;
+        globalEpoch.store(e + 1);
+        freeBag(limbo[(e + 1 + 1) % NUM_BAGS]); // i.e., the objects retired in epoch (e+1)-2
+    }
+
+public:
+    epochReclaimer(const int _numThreads) : globalEpoch(0), pending(0), numThreads(_numThreads) {
+        for (int i=0;i<MAX_THREADS;++i) announced[i].v.store(QUIESCENT, memory_order_relaxed);
+    }
+    ~epochReclaimer() {
+        for (int i=0;i<NUM_BAGS;++i) freeBag(limbo[i]);
+    }
+
+    // call at the start of every operation (and only at points where the caller holds no pointers obtained in an earlier call)
+    void enter(const int tid) {
+        int64_t e = globalEpoch.load(memory_order_relaxed);
+        if (announced[tid].v.load(memory_order_relaxed) == e) return;
+        announced[tid].v.store(e, memory_order_relaxed);
+        atomic_thread_fence(memory_order_seq_cst); // our announcement must be visible before we read any shared pointer
+        if (pending.load(memory_order_relaxed) > 0) tryAdvance(e);
+    }
+
+    // call when thread tid won't perform operations for a while
+    void quiesce(const int tid) {
+        announced[tid].v.store(QUIESCENT, memory_order_release);
+    }
+
+    // ptr must already be unreachable for operations that start from now on. deleter(ptr) runs once no operation can still reach it.
+    void retire(const int tid, void * ptr, void (*deleter)(void *)) {
+        int64_t e;
+        {
+            lock_guard<mutex> lock(limboLock);
+            e = globalEpoch.load();
+            limbo[e % NUM_BAGS].push_back({ptr, deleter});
+            pending.fetch_add(1);
+        }
+        tryAdvance(e);
+    }
+};
+
+uint32_t murmur3(uint32_t key, const uint32_t seed = 0x1a8b714c) {
     constexpr uint32_t c1 = 0xCC9E2D51;
     constexpr uint32_t c2 = 0x1B873593;
     constexpr uint32_t n = 0xE6546B64;
@@ -181,5 +435,591 @@ uint32_t murmur3(uint32_t key) {
     return h;
 }
 
+/**
+ * hash policies: function objects that map a 32-bit key to a 32-bit hash. tables take one of these as a template parameter and keep an instance of it,
+ * so a policy can carry per-table state such as a random seed.
+ */
+
+// murmur3 with a fixed seed (the original hash of every algorithm)
+struct Murmur3Finalizer {
+    uint32_t operator()(const uint32_t key) const { return murmur3(key); }
+};
+
+// murmur3 with a seed drawn at random when the table is created, so that an adversary can't precompute keys that collide
+struct SeededMurmur3 {
+    const uint32_t seed;
+    SeededMurmur3() : seed(random_device()()) {}
+    uint32_t operator()(const uint32_t key) const { return murmur3(key, seed); }
+};
+
+// cheap multiply-xorshift mixer (two multiplies, three shifts) with good avalanche in both the low and the high bits
+struct MultiplyXorshiftHash {
+    uint32_t operator()(uint32_t key) const {
+        key ^= key >> 16;
+        key *= 0x7FEB352D;
+        key ^= key >> 15;
+        key *= 0x846CA68B;
+        key ^= key >> 16;
+        return key;
+    }
+};
+
+// a single crc32c instruction when compiled for SSE4.2 (bit-at-a-time fallback otherwise)
+struct Crc32cHash {
+    uint32_t operator()(const uint32_t key) const {
+#if defined(__SSE4_2__)
+        return _mm_crc32_u32(0xFFFFFFFF, key);
+#else
+        uint32_t crc = 0xFFFFFFFF ^ key;
+        for (int i=0;i<32;++i) crc = (crc >> 1) ^ (0x82F63B78 & (0 - (crc & 1)));
+        return crc;
+#endif
+    }
+};
+
+// no hashing at all, for keys that are already hashes.
+// note: FastRangeIndexing uses the high bits of the hash, so small (non-hashed) keys would all land near slot 0
+struct IdentityHash {
+    uint32_t operator()(const uint32_t key) const { return key; }
+};
+
+/**
+ * a key of N bytes (e.g., fixedKey<16> for a UUID), compared bytewise. tables that are templated on their key type take these as well as integers
+ */
+template <int N>
+struct fixedKey {
+    static_assert(N % sizeof(uint32_t) == 0, "hashKey() hashes keys 32 bits at a time");
+    uint8_t bytes[N];
+
+    // friends rather than members, so that they also apply to an atomic<fixedKey> (which converts to its value)
+    friend bool operator==(const fixedKey & a, const fixedKey & b) { return !memcmp(a.bytes, b.bytes, N); }
+    friend bool operator!=(const fixedKey & a, const fixedKey & b) { return !(a == b); }
+    friend bool operator<(const fixedKey & a, const fixedKey & b) { return memcmp(a.bytes, b.bytes, N) < 0; }
+    static constexpr fixedKey filled(const uint8_t byte) {
+        fixedKey key {};
+        for(int i = 0; i < N; i++)
+            key.bytes[i] = byte;
+        return key;
+    }
+};
+
+// the hash functions above take 32 bits. a wider key is hashed 32 bits at a time, each word mixed with the hash of the words before it, so that every bit of the key matters
+template <class Hash, class Key>
+inline uint32_t hashKey(const Hash & hasher, const Key & key) {
+    static_assert(sizeof(Key) % sizeof(uint32_t) == 0, "keys must be a whole number of 32-bit words");
+    uint32_t words[sizeof(Key) / sizeof(uint32_t)];
+    memcpy(words, &key, sizeof(Key));
+    uint32_t h = hasher(words[0]);
+    for(size_t i = 1; i < sizeof(Key) / sizeof(uint32_t); i++)
+        h = hasher(words[i] ^ h);
+    return h;
+}
+
+// a string is hashed the same way, starting from its length (so that "a" and "a\0" differ), with its last word zero padded
+template <class Hash>
+inline uint32_t hashKey(const Hash & hasher, const string_view & key) {
+    uint32_t h = hasher((uint32_t) key.size());
+    size_t i = 0;
+    for(; i + sizeof(uint32_t) <= key.size(); i += sizeof(uint32_t)) {
+        uint32_t word;
+        memcpy(&word, key.data() + i, sizeof(word));
+        h = hasher(word ^ h);
+    }
+    if(i < key.size()) {
+        uint32_t word = 0;
+        memcpy(&word, key.data() + i, key.size() - i);
+        h = hasher(word ^ h);
+    }
+    return h;
+}
+
+// what getSumOfKeys() adds up for a key: an integer key itself, and any other key's hashKey() under murmur3, so that the sums of tables of wider keys can be compared too
+template <class Key>
+inline int64_t keyChecksum(const Key & key) {
+    if constexpr (is_integral<Key>::value) return (int64_t) key;
+    else return hashKey(Murmur3Finalizer(), key);
+}
+
+// the two values of a key type that a table which stores bare keys in its slots marks EMPTY and erased slots with (for int, the original -2 and -1)
+template <class Key>
+struct reservedKeys {
+    static constexpr Key empty() { return (Key) -2; }
+    static constexpr Key tombstone() { return (Key) -1; }
+};
+template <int N>
+struct reservedKeys<fixedKey<N>> {
+    static constexpr fixedKey<N> empty() { return fixedKey<N>::filled(0xFE); }
+    static constexpr fixedKey<N> tombstone() { return fixedKey<N>::filled(0xFF); }
+};
+
+/**
+ * indexing (capacity) policies: how a table rounds its capacity, reduces a 32-bit hash to a home slot in [0, capacity),
+ * and steps to the next slot while linear probing. tables take one of these as a template parameter.
+ */
+
+// home slot h % capacity and a modulo on every probe step. any capacity; an integer division per step (the original behaviour of algorithms A, B and C)
+struct ModuloIndexing {
+    static int roundCapacity(const int capacity) { return capacity; }
+    static int home(const uint32_t h, const int capacity) { return h % (uint32_t) capacity; }
+    static int next(const int index, const int capacity) { return (index + 1) % capacity; }
+};
+
+// home slot (h * capacity) >> 32, i.e., h scaled into [0, capacity) with a multiply and a shift instead of a division. any capacity; probing wraps with a compare
+struct FastRangeIndexing {
+    static int roundCapacity(const int capacity) { return capacity; }
+    static int home(const uint32_t h, const int capacity) { return (int) (((uint64_t) h * (uint32_t) capacity) >> 32); }
+    static int next(const int index, const int capacity) { return (index + 1 == capacity) ? 0 : index + 1; }
+};
+
+// capacity rounded up to a power of two, so both the home slot and every probe step are a bitwise and
+struct PowerOfTwoIndexing {
+    static int roundCapacity(const int capacity) {
+        int result = 1;
+        while (result < capacity) result <<= 1;
+        return result;
+    }
+    static int home(const uint32_t h, const int capacity) { return h & (capacity - 1); }
+    static int next(const int index, const int capacity) { return (index + 1) & (capacity - 1); }
+};
+
+// hint to the CPU that we are busy-waiting
+inline void cpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+// test-and-test-and-set spinlock: waiters spin on a plain load of their cached copy, and only try the exchange once the lock looks free
+class ttasLock {
+private:
+    atomic<bool> locked;
+public:
+    ttasLock() : locked(false) {}
+    void lock() {
+        while (locked.load(memory_order_relaxed) || locked.exchange(true, memory_order_acquire)) cpuRelax();
+    }
+    void unlock() {
+        locked.store(false, memory_order_release);
+    }
+};
+
+// ticket spinlock: waiters are served in FIFO order, so no thread starves under contention
+class ticketLock {
+private:
+    atomic<uint32_t> next;
+    atomic<uint32_t> serving;
+public:
+    ticketLock() : next(0), serving(0) {}
+    void lock() {
+        const uint32_t ticket = next.fetch_add(1, memory_order_relaxed);
+        while (serving.load(memory_order_acquire) != ticket) cpuRelax();
+    }
+    void unlock() {
+        serving.store(serving.load(memory_order_relaxed) + 1, memory_order_release);
+    }
+};
+
+/**
+ * sequence lock: writers acquire it like a ttasLock, and the sequence number is odd while it is held.
+ * readers don't write to the lock at all: they read the sequence number, read the data, and validate that the sequence number is still the same (and even).
+ */
+class seqLock {
+private:
+    atomic<uint32_t> seq;
+public:
+    seqLock() : seq(0) {}
+    void lock() {
+        while (true) {
+            uint32_t s = seq.load(memory_order_relaxed);
+            if (!(s & 1) && seq.compare_exchange_weak(s, s + 1, memory_order_acquire)) return;
+            cpuRelax();
+        }
+    }
+    void unlock() {
+        seq.store(seq.load(memory_order_relaxed) + 1, memory_order_release);
+    }
+    uint32_t readBegin() {
+        uint32_t s;
+        while ((s = seq.load(memory_order_acquire)) & 1) cpuRelax();
+        return s;
+    }
+    bool readValidate(const uint32_t s) {
+        atomic_thread_fence(memory_order_acquire);
+        return seq.load(memory_order_relaxed) == s;
+    }
+};
+
+// detects locks that support optimistic (validated) reads, like seqLock
+template <class Lock, class = void>
+struct hasOptimisticReads : false_type {};
+template <class Lock>
+struct hasOptimisticReads<Lock, void_t<decltype(&Lock::readBegin), decltype(&Lock::readValidate)>> : true_type {};
+
+// reads key, which writers only modify while holding l, without acquiring l. the read is validated if Lock supports it, and a plain (racy) load otherwise
+template <class Lock, class Key>
+Key readUnlocked(Lock & l, const Key & key) {
+    if constexpr (hasOptimisticReads<Lock>::value) {
+        while (true) {
+            const uint32_t s = l.readBegin();
+            const Key result = *(const volatile Key *) &key;
+            if (l.readValidate(s)) return result;
+        }
+    } else {
+        return key;
+    }
+}
+
+/**
+ * bucket layouts for the non-expandable tables (algorithms A, B and C): how the key of every slot, and the lock that protects it (if any), are laid out in memory.
+ * a table takes one of these as a template parameter and keeps a storage<Key, Lock>, which exposes the key and the lock of slot i.
+ */
+
+// the "lock" of a lock-free table. takes no space in a bucket
+struct noLock {
+    void lock() {}
+    void unlock() {}
+};
+
+// every slot (key and lock) in its own cache line: no false sharing between slots, but 64 bytes per key and one cache miss per probe step (the original layout)
+struct PaddedLayout {
+    template <class Key, class Lock>
+    struct storage {
+        struct alignas(PADDING_BYTES) bucket {
+            [[no_unique_address]] Lock m;
+            Key key;
+        };
+        bucket * buckets;
+        storage(const int capacity) : buckets(new bucket[capacity]) {}
+        ~storage() { delete[] buckets; }
+        Key & key(const int i) { return buckets[i].key; }
+        Lock & lock(const int i) { return buckets[i].m; }
+    };
+};
+
+// slots stored back to back (e.g., 4 bytes per slot without locks): the smallest footprint, and consecutive probe steps usually hit the same cache line
+struct PackedLayout {
+    template <class Key, class Lock>
+    struct storage {
+        struct bucket {
+            [[no_unique_address]] Lock m;
+            Key key;
+        };
+        bucket * buckets;
+        storage(const int capacity) : buckets(new bucket[capacity]) {}
+        ~storage() { delete[] buckets; }
+        Key & key(const int i) { return buckets[i].key; }
+        Lock & lock(const int i) { return buckets[i].m; }
+    };
+};
+
+// one cache line per SLOTS_PER_LINE consecutive slots, which share that line's lock. keeps locked tables dense without packing a lock next to every key
+struct StripedLayout {
+    template <class Key, class Lock>
+    struct storage {
+        static constexpr int LOCK_BYTES = is_empty<Lock>::value ? 0 : sizeof(Lock);
+        static constexpr int SLOTS_PER_LINE = (PADDING_BYTES - LOCK_BYTES) / sizeof(Key);
+        static_assert(SLOTS_PER_LINE > 0, "a lock and a key must fit in one cache line");
+        struct alignas(PADDING_BYTES) line {
+            [[no_unique_address]] Lock m;
+            Key keys[SLOTS_PER_LINE];
+        };
+        line * lines;
+        storage(const int capacity) : lines(new line[(capacity + SLOTS_PER_LINE - 1) / SLOTS_PER_LINE]) {}
+        ~storage() { delete[] lines; }
+        Key & key(const int i) { return lines[i / SLOTS_PER_LINE].keys[i % SLOTS_PER_LINE]; }
+        Lock & lock(const int i) { return lines[i / SLOTS_PER_LINE].m; }
+    };
+};
+
+// keys stored back to back, and protected by a separate table of NUM_STRIPES locks, each in its own cache line (slot i is protected by lock i % NUM_STRIPES).
+// the memory spent on locks no longer grows with the capacity, and neighbouring slots are protected by different locks
+template <int NUM_STRIPES = LOCK_STRIPES>
+struct LockTableLayout {
+    template <class Key, class Lock>
+    struct storage {
+        struct alignas(PADDING_BYTES) stripe {
+            [[no_unique_address]] Lock m;
+        };
+        Key * keys;
+        stripe * stripes;
+        storage(const int capacity) : keys(new Key[capacity]), stripes(new stripe[NUM_STRIPES]) {}
+        ~storage() { delete[] keys; delete[] stripes; }
+        Key & key(const int i) { return keys[i]; }
+        Lock & lock(const int i) { return stripes[i % NUM_STRIPES].m; }
+    };
+};
+
+/**
+ * NUMA topology (read from sysfs) and placement of large arrays (with the mbind system call), so no libnuma is needed.
+ * on a machine or container without NUMA information, everything behaves as if there were one node holding every CPU.
+ */
+class numaTopology {
+public:
+    vector<int> nodes;              // ids of the online nodes that have CPUs
+    vector<vector<int>> cpus;       // cpus[n] = the CPUs of nodes[n]
+
+private:
+    // parses a sysfs CPU list such as "0-3,8-11"
+    static vector<int> parseCpuList(const string & list) {
+        vector<int> result;
+        stringstream ss(list);
+        string range;
+        while(getline(ss, range, ',')) {
+            if(range.empty() || !isdigit(range[0])) continue;
+            int lo = atoi(range.c_str());
+            size_t dash = range.find('-');
+            int hi = (dash == string::npos) ? lo : atoi(range.c_str() + dash + 1);
+            for(int c = lo; c <= hi; c++) result.push_back(c);
+        }
+        return result;
+    }
+
+    numaTopology() {
+        for(int node = 0; node < 1024; node++) {
+            ifstream f("/sys/devices/system/node/node" + to_string(node) + "/cpulist");
+            if(!f) continue;
+            string list;
+            getline(f, list);
+            vector<int> nodeCpus = parseCpuList(list);
+            if(nodeCpus.empty()) continue; // a memory-only node
+            nodes.push_back(node);
+            cpus.push_back(nodeCpus);
+        }
+        if(nodes.empty()) {
+            nodes.push_back(0);
+            cpus.push_back({});
+            for(int c = 0; c < (int) max(1u, thread::hardware_concurrency()); c++) cpus[0].push_back(c);
+        }
+    }
+
+public:
+    static const numaTopology & get() {
+        static numaTopology topology;
+        return topology;
+    }
+
+    int numNodes() const {
+        return nodes.size();
+    }
+
+    // the CPU for the tid-th thread. compact fills the CPUs of the first node before moving on to the next; scatter deals consecutive threads to different nodes.
+    // with more threads than CPUs, threads wrap around and share CPUs
+    int cpuOf(const int tid, const bool scatter) const {
+        int totalCpus = 0;
+        for(auto & c : cpus) totalCpus += c.size();
+        int i = tid % totalCpus;
+        if(scatter) {
+            // round robin over the nodes, skipping nodes whose CPUs are used up
+            for(int round = 0; ; round++) {
+                for(int n = 0; n < numNodes(); n++) {
+                    if(round >= (int) cpus[n].size()) continue;
+                    if(i-- == 0) return cpus[n][round];
+                }
+            }
+        }
+        for(int n = 0; ; n++) {
+            if(i < (int) cpus[n].size()) return cpus[n][i];
+            i -= cpus[n].size();
+        }
+    }
+
+    // pins the calling thread to cpu. returns false if that isn't allowed (e.g., the CPU is outside this process' cpuset)
+    static bool pinTo(const int cpu) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        return sched_setaffinity(0, sizeof(set), &set) == 0;
+    }
+};
+
+/**
+ * where the pages of a large array go:
+ *   NUMA_FIRST_TOUCH   the kernel's default: each page lands on the node of the thread that first touches it
+ *   NUMA_INTERLEAVE    pages are spread round robin over all nodes, so threads on every node see the same average latency and the load on the memory controllers is balanced
+ *   NUMA_PARTITION     the array is cut into one contiguous block per node
+ */
+enum numaPolicy { NUMA_FIRST_TOUCH, NUMA_INTERLEAVE, NUMA_PARTITION };
+
+/**
+ * the size of the pages that back a large array. random probes of a big table touch a different page almost every time, so with 4KB pages nearly every probe
+ * also misses in the TLB; one 2MB page covers 512 times as much of the table.
+ *   HUGE_PAGES_OFF      regular pages
+ *   HUGE_PAGES_THP      transparent huge pages (madvise(MADV_HUGEPAGE)): the kernel backs the array with huge pages when it can, and with regular pages otherwise
+ *   HUGE_PAGES_HUGETLB  pages from the reserved hugetlbfs pool (MAP_HUGETLB, see /proc/sys/vm/nr_hugepages). if the pool can't hold the array, falls back to HUGE_PAGES_THP
+ */
+enum hugePagePolicy { HUGE_PAGES_OFF, HUGE_PAGES_THP, HUGE_PAGES_HUGETLB };
+
+#ifndef HUGE_PAGE_BYTES
+#define HUGE_PAGE_BYTES (2 << 20)
+#endif
+
+// how a large array is allocated (see numaPolicy and hugePagePolicy)
+struct memoryPolicy {
+    numaPolicy placement = NUMA_FIRST_TOUCH;
+    hugePagePolicy pages = HUGE_PAGES_OFF;
+};
+
+// number of bytes that allocateZeroed() maps for an array of the given size: whole huge pages whenever huge pages may back it
+inline size_t mappedBytes(const size_t bytes, const memoryPolicy & policy) {
+    if(policy.pages == HUGE_PAGES_OFF)
+        return bytes;
+    return (bytes + HUGE_PAGE_BYTES - 1) / HUGE_PAGE_BYTES * HUGE_PAGE_BYTES;
+}
+
+// applies placement to the mapping [p, p + length)
+inline void placeOnNodes(void * p, const size_t length, const numaPolicy placement, const size_t pageSize) {
+    const numaTopology & topology = numaTopology::get();
+    const int maxNode = *max_element(topology.nodes.begin(), topology.nodes.end());
+    vector<unsigned long> mask(maxNode / (8 * sizeof(unsigned long)) + 1, 0);
+    auto setNode = [&](const int node) { mask[node / (8 * sizeof(unsigned long))] |= 1UL << (node % (8 * sizeof(unsigned long))); };
+    // a failed mbind (e.g., a kernel without NUMA support, or nodes outside our cpuset) leaves the default policy, which is still correct
+    if(placement == NUMA_INTERLEAVE) {
+        for(int node : topology.nodes) setNode(node);
+        syscall(SYS_mbind, p, length, MPOL_INTERLEAVE, mask.data(), maxNode + 2, 0);
+    } else if(placement == NUMA_PARTITION) {
+        const size_t pages = (length + pageSize - 1) / pageSize;
+        for(int n = 0; n < topology.numNodes(); n++) {
+            size_t first = pages * n / topology.numNodes();
+            size_t last = pages * (n + 1) / topology.numNodes();
+            if(first == last) continue;
+            fill(mask.begin(), mask.end(), 0);
+            setNode(topology.nodes[n]);
+            syscall(SYS_mbind, (char *) p + first * pageSize, (last - first) * pageSize, MPOL_PREFERRED, mask.data(), maxNode + 2, 0);
+        }
+    }
+}
+
+/**
+ * returns bytes of zero-filled memory allocated according to policy, or NULL if there isn't enough memory. release it with freeZeroed().
+ * the memory consists of fresh pages that the kernel zeroes lazily, when each page is first touched and on the node the policy picks for it.
+ * so no thread has to initialize the array (which would also first-touch all of it onto its own node), and that cost is spread over the threads that use the array
+ */
+inline void * allocateZeroed(const size_t bytes, const memoryPolicy & policy) {
+    if(policy.placement == NUMA_FIRST_TOUCH && policy.pages == HUGE_PAGES_OFF)
+        return calloc(1, bytes);
+    const size_t length = mappedBytes(bytes, policy);
+    void * p = MAP_FAILED;
+    if(policy.pages == HUGE_PAGES_HUGETLB)
+        p = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if(p == MAP_FAILED) {
+        p = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(p == MAP_FAILED)
+            return NULL;
+        if(policy.pages != HUGE_PAGES_OFF)
+            madvise(p, length, MADV_HUGEPAGE);
+    }
+    placeOnNodes(p, length, policy.placement, (policy.pages == HUGE_PAGES_OFF) ? sysconf(_SC_PAGESIZE) : HUGE_PAGE_BYTES);
+    return p;
+}
+
+// frees memory returned by allocateZeroed(bytes, policy)
+inline void freeZeroed(void * p, const size_t bytes, const memoryPolicy & policy) {
+    if(policy.placement == NUMA_FIRST_TOUCH && policy.pages == HUGE_PAGES_OFF)
+        free(p);
+    else if(p)
+        munmap(p, mappedBytes(bytes, policy));
+}
+
+// calls body(i) for i = 0..n-1, split among the OpenMP threads
+template <class Body>
+void parallelFor(const int n, Body body) {
+    #pragma omp parallel for schedule(static)
+    for(int i = 0; i < n; i++)
+        body(i);
+}
+
+// each OpenMP thread starts from identity and calls accumulate(partial, i) for its share of i = 0..n-1, and the partial results are combined in no particular order
+template <class T, class Accumulate, class Combine>
+T parallelReduce(const int n, const T & identity, Accumulate accumulate, Combine combine) {
+    T result = identity;
+    #pragma omp parallel
+    {
+        T partial = identity;
+        #pragma omp for schedule(static) nowait
+        for(int i = 0; i < n; i++)
+            accumulate(partial, i);
+        #pragma omp critical
+        result = combine(result, partial);
+    }
+    return result;
+}
+
+// pwrite()/pread() that retry until all bytes are transferred. return false on an error (or, reading, at the end of the file)
+inline bool pwriteAll(const int fd, const void * buf, size_t bytes, off_t offset) {
+    while(bytes > 0) {
+        ssize_t n = pwrite(fd, buf, bytes, offset);
+        if(n < 0 && errno == EINTR) continue;
+        if(n <= 0) return false;
+        buf = (const char *) buf + n;
+        bytes -= n;
+        offset += n;
+    }
+    return true;
+}
+inline bool preadAll(const int fd, void * buf, size_t bytes, off_t offset) {
+    while(bytes > 0) {
+        ssize_t n = pread(fd, buf, bytes, offset);
+        if(n < 0 && errno == EINTR) continue;
+        if(n <= 0) return false;
+        buf = (char *) buf + n;
+        bytes -= n;
+        offset += n;
+    }
+    return true;
+}
+
+/**
+ * the keys of a bulk load, grouped by the range of rangeSize slots their home slot falls in: range r holds the keys whose home is in [r * rangeSize, (r+1) * rangeSize),
+ * and they are keys[start[r]] .. keys[start[r+1] - 1], with their home slots in homes[]. a parallel counting sort: each OpenMP thread counts the keys of its share of the input
+ * per range, then scatters them to its own offsets within each range, so no two threads write the same element.
+ */
+template <class Key>
+struct bulkPartition {
+    vector<Key> keys;
+    vector<int> homes;
+    vector<size_t> start;
+
+    template <class HomeOf>
+    bulkPartition(span<const Key> input, const int capacity, const int rangeSize, HomeOf homeOf)
+    : keys(input.size()), homes(input.size()), start((capacity + rangeSize - 1) / rangeSize + 1) {
+        const size_t n = input.size();
+        const int numRanges = start.size() - 1;
+        const int maxThreads = omp_get_max_threads();
+        vector<int> unsortedHomes(n);
+        vector<size_t> offsets((size_t) maxThreads * numRanges, 0); // thread i's next position in range r is offsets[i * numRanges + r]
+        #pragma omp parallel
+        {
+            size_t * mine = &offsets[(size_t) omp_get_thread_num() * numRanges];
+            // both loops use the same static schedule over the same iterations, so each thread scatters exactly the keys it counted
+            #pragma omp for schedule(static)
+            for(size_t j = 0; j < n; j++) {
+                unsortedHomes[j] = homeOf(input[j]);
+                mine[unsortedHomes[j] / rangeSize]++;
+            }
+            #pragma omp single
+            {
+                const int numThreads = omp_get_num_threads();
+                size_t position = 0;
+                for(int r = 0; r < numRanges; r++) {
+                    start[r] = position;
+                    for(int i = 0; i < numThreads; i++) {
+                        size_t count = offsets[(size_t) i * numRanges + r];
+                        offsets[(size_t) i * numRanges + r] = position;
+                        position += count;
+                    }
+                }
+                start[numRanges] = position;
+            }
+            #pragma omp for schedule(static)
+            for(size_t j = 0; j < n; j++) {
+                size_t position = mine[unsortedHomes[j] / rangeSize]++;
+                keys[position] = input[j];
+                homes[position] = unsortedHomes[j];
+            }
+        }
+    }
+    int numRanges() const { return start.size() - 1; }
+};
+
 #endif /* UTIL_H */
 
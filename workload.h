@@ -0,0 +1,233 @@
+#pragma once
+#include "util.h"
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <vector>
+using namespace std;
+
+#ifndef KEY_STREAM_LENGTH
+#define KEY_STREAM_LENGTH (1 << 20)     // the fewest operations precomputed per thread. a thread that runs out starts over at the beginning of its stream
+#endif
+#ifndef KEY_STREAM_OPS_PER_MILLI
+#define KEY_STREAM_OPS_PER_MILLI 16000  // operations precomputed per thread for each millisecond of the run: more than a thread completes on an uncontended table, so that it doesn't run out
+#endif
+#ifndef MAX_KEY_STREAM_OPS
+#define MAX_KEY_STREAM_OPS (1 << 28)    // the most operations precomputed by all threads together (5 bytes each), which only long runs with many threads reach
+#endif
+
+// operation types of a workload (also used to record latencies separately, see -lat)
+enum { OP_CONTAINS, OP_INSERT, OP_ERASE, NUM_OP_TYPES };
+const char * const OP_NAMES[NUM_OP_TYPES] = { "contains", "insert", "erase" };
+
+// one thread's precomputed operations: the benchmark loop just reads keys[next] and ops[next], so generating keys is not part of what is measured
+struct keyStream {
+    int * keys;
+    uint8_t * ops;
+    int length;
+    int next;
+    int wraps;      // how many times the thread ran out of operations and started over
+
+    keyStream() : keys(NULL), ops(NULL), length(0), next(0), wraps(0) {}
+    ~keyStream() {
+        delete[] keys;
+        delete[] ops;
+    }
+    // returns the index of the next operation in keys and ops
+    int advance() {
+        int j = next;
+        if(++next == length) {
+            next = 0;
+            wraps++;
+        }
+        return j;
+    }
+};
+
+/**
+ * the keys and operation types that the benchmark threads perform, selected with -d:
+ *   uniform            keys drawn uniformly from [1, keyRangeSize]
+ *   zipf[:theta]       key k is drawn with probability proportional to 1/k^theta, 0 < theta < 1 (default 0.99): a few small keys get most of the operations
+ *   hotspot[:f[:p]]    a fraction p of the operations go to the hot set, the smallest fraction f of the keys (default 0.01 and 0.9); the rest are uniform over the other keys
+ *   sequential         each thread walks its own slice of [1, keyRangeSize] in increasing order, wrapping around at the end of the slice
+ *   trace:file         replay a binary trace of (int32 op, int32 key) records, op in { 0: contains, 1: insert, 2: erase }, dealt out to the threads round robin
+ * except when replaying a trace, the operation types are drawn like the keys: readPercent% lookups, and the rest split evenly between inserts and erases.
+ */
+class workload {
+public:
+    enum kind_t { UNIFORM, ZIPF, HOTSPOT, SEQUENTIAL, REPLAY };
+    kind_t kind;
+    int keyRangeSize;
+    int readPercent;
+    double theta;
+    double hotFraction;
+    double hotProbability;
+    double prefillFraction;     // of the key range that the set holds when the trial starts (-lf)
+    vector<int> traceKeys;
+    vector<uint8_t> traceOps;
+
+private:
+    // constants of the zipf generator of Gray et al., "Quickly generating billion-record synthetic databases" (SIGMOD '94)
+    double zetan;
+    double zeta2;
+    double alpha;
+    double eta;
+
+    static double zeta(const long long n, const double theta) {
+        double sum = 0;
+        for(long long i = 1; i <= n; i++)
+            sum += 1 / pow((double) i, theta);
+        return sum;
+    }
+
+    static double nextDouble(PaddedRandom & rng) {
+        return rng.nextNatural() / (double) numeric_limits<unsigned int>::max();
+    }
+
+    int nextZipf(PaddedRandom & rng) {
+        double u = nextDouble(rng);
+        double uz = u * zetan;
+        if(uz < 1)
+            return 1;
+        if(uz < 1 + pow(0.5, theta))
+            return 2;
+        return 1 + min((int) (keyRangeSize * pow(eta * u - eta + 1, alpha)), keyRangeSize - 1);
+    }
+
+    bool loadTrace(const char * path) {
+        FILE * f = fopen(path, "rb");
+        if(!f) {
+            cout<<"ERROR: could not open trace file "<<path<<endl;
+            return false;
+        }
+        int32_t record[2];
+        while(fread(record, sizeof(record), 1, f) == 1) {
+            if(record[0] < 0 || record[0] >= NUM_OP_TYPES || record[1] < 1) {
+                cout<<"ERROR: bad record #"<<traceKeys.size()<<" (op="<<record[0]<<", key="<<record[1]<<") in trace file "<<path<<endl;
+                fclose(f);
+                return false;
+            }
+            traceOps.push_back((uint8_t) record[0]);
+            traceKeys.push_back(record[1]);
+        }
+        fclose(f);
+        return true;
+    }
+
+public:
+    /**
+     * parses the -d argument spec. the zipf constants (which take a pass over the key range) and the trace are prepared here, once, before the threads start.
+     * returns false (after printing why) if spec is not a valid distribution
+     */
+    bool init(const char * spec, const int _keyRangeSize, const int _readPercent) {
+        keyRangeSize = _keyRangeSize;
+        readPercent = _readPercent;
+        theta = 0.99;
+        hotFraction = 0.01;
+        hotProbability = 0.9;
+        prefillFraction = 0;
+        const char * args = strchr(spec, ':');
+        const size_t nameLength = args ? args - spec : strlen(spec);
+        auto is = [&](const char * name) { return nameLength == strlen(name) && !strncmp(spec, name, nameLength); };
+        if(is("uniform") && !args) {
+            kind = UNIFORM;
+        } else if(is("zipf")) {
+            kind = ZIPF;
+            if(args) theta = atof(args + 1);
+            if(!(theta > 0 && theta < 1)) {
+                cout<<"ERROR: zipf theta="<<theta<<" must be in (0, 1)"<<endl;
+                return false;
+            }
+            zetan = zeta(keyRangeSize, theta);
+            zeta2 = zeta(2, theta);
+            alpha = 1 / (1 - theta);
+            eta = (1 - pow(2. / keyRangeSize, 1 - theta)) / (1 - zeta2 / zetan);
+        } else if(is("hotspot")) {
+            kind = HOTSPOT;
+            if(args) {
+                hotFraction = atof(args + 1);
+                const char * p = strchr(args + 1, ':');
+                if(p) hotProbability = atof(p + 1);
+            }
+            if(!(hotFraction > 0 && hotFraction < 1) || !(hotProbability >= 0 && hotProbability <= 1)) {
+                cout<<"ERROR: hotspot fraction="<<hotFraction<<" must be in (0, 1) and probability="<<hotProbability<<" in [0, 1]"<<endl;
+                return false;
+            }
+        } else if(is("sequential") && !args) {
+            kind = SEQUENTIAL;
+        } else if(is("trace") && args) {
+            kind = REPLAY;
+            if(!loadTrace(args + 1))
+                return false;
+            if(traceKeys.empty()) {
+                cout<<"ERROR: trace file "<<(args + 1)<<" is empty"<<endl;
+                return false;
+            }
+        } else {
+            cout<<"Bad key distribution: "<<spec<<endl;
+            return false;
+        }
+        return true;
+    }
+
+    // call insert(key) for each key the set should hold before the trial starts: every key of the range with probability prefillFraction, drawing random numbers from rng
+    template <class Insert>
+    void prefill(PaddedRandom & rng, Insert insert) {
+        if(prefillFraction <= 0)
+            return;
+        for(int key = 1; key <= keyRangeSize; key++)
+            if(nextDouble(rng) < prefillFraction)
+                insert(key);
+    }
+
+    // precompute the operations of thread tid (of totalThreads) for a run of millisToRun, drawing random numbers from rng: KEY_STREAM_OPS_PER_MILLI for each millisecond,
+    // but at least KEY_STREAM_LENGTH, and at most this thread's share of MAX_KEY_STREAM_OPS (or, replaying a trace, this thread's share of its records)
+    void fillStream(const int tid, const int totalThreads, const int millisToRun, PaddedRandom & rng, keyStream & stream) {
+        if(kind == REPLAY) {
+            const int n = traceKeys.size();
+            stream.length = max(1, n / totalThreads + (tid < n % totalThreads));
+        } else {
+            const long long share = MAX_KEY_STREAM_OPS / totalThreads;
+            stream.length = max((long long) KEY_STREAM_LENGTH, min((long long) millisToRun * KEY_STREAM_OPS_PER_MILLI, share));
+        }
+        stream.keys = new int[stream.length];
+        stream.ops = new uint8_t[stream.length];
+        stream.next = 0;
+
+        const double readFraction = readPercent / 100.;
+        const double insertFraction = readFraction + (1 - readFraction) / 2; // remaining operations are split evenly between inserts and erases
+        const int hotKeys = max(1, (int) (hotFraction * keyRangeSize));
+        const int sliceSize = max(1, keyRangeSize / totalThreads);
+        for(int j = 0; j < stream.length; j++) {
+            if(kind == REPLAY) {
+                const int r = (tid + (long long) j * totalThreads) % traceKeys.size(); // a thread with no records of its own (more threads than records) replays one of another thread's
+                stream.keys[j] = traceKeys[r];
+                stream.ops[j] = traceOps[r];
+                continue;
+            }
+            double operationType = nextDouble(rng);
+            stream.ops[j] = (operationType < readFraction) ? OP_CONTAINS : (operationType < insertFraction) ? OP_INSERT : OP_ERASE;
+            switch(kind) {
+                case UNIFORM:
+                    stream.keys[j] = 1 + (rng.nextNatural() % keyRangeSize);
+                    break;
+                case ZIPF:
+                    stream.keys[j] = nextZipf(rng);
+                    break;
+                case HOTSPOT:
+                    if(nextDouble(rng) < hotProbability || hotKeys == keyRangeSize)
+                        stream.keys[j] = 1 + (rng.nextNatural() % hotKeys);
+                    else
+                        stream.keys[j] = 1 + hotKeys + (rng.nextNatural() % (keyRangeSize - hotKeys));
+                    break;
+                case SEQUENTIAL:
+                    stream.keys[j] = 1 + ((long long) tid * sliceSize + j % sliceSize) % keyRangeSize;
+                    break;
+                default:
+                    break;
+            }
+        }
+    }
+};